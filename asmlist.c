@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "pvm/listing.h"
+
+// asmlist: assemble a source file and print a listing annotated with a
+// static cost model, followed by basic-block, loop and label summaries.
+//
+//   asmlist [-c costs.txt] [-o listing.txt] prog.asm
+//
+// The cost file holds "<opcode> <cost>" lines over the built-in defaults,
+// e.g. "LDI 5".
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: asmlist [-c costs.txt] [-o listing.txt] prog.asm\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *costs = NULL;
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            costs = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        usage();
+        return 1;
+    }
+
+    vm_cost_model_t model;
+    vm_cost_model_default(&model);
+    if (costs && !vm_cost_model_load(&model, costs))
+        return 1;
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out)
+    {
+        perror(output);
+        return 1;
+    }
+
+    bool ok = assemble_listing(argv[optind], &model, out);
+    if (output)
+        fclose(out);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "pvm/assembler.h"
+#include "pvm/batch.h"
+#include "pvm/vm.h"
+
+// batch: run a corpus of (image, input) jobs across worker threads.
+//
+//   batch [-j threads] [-b budget] [-t traps.asm] [-o results] -p prog.asm [-p ...] jobfile
+//
+// Each jobfile line is "<image-index> <input-file> [budget]", where the
+// image index refers to the -p programs in order and "-" means no input.
+// One result line per job is written as:
+//   <job> <reason> <instructions> <output, C-escaped>
+
+#define MAX_IMAGES 64
+
+typedef struct
+{
+    batch_job_t *jobs;
+    uint8_t **inputs;
+    size_t count;
+    size_t cap;
+} job_list;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: batch [-j threads] [-b budget] [-t traps.asm] [-o results] -p prog.asm [-p ...] jobfile\n");
+}
+
+// Reads a job's input; "-" means none and leaves *data NULL.
+static bool read_file(const char *path, uint8_t **data, size_t *len)
+{
+    *data = NULL;
+    *len = 0;
+    if (strcmp(path, "-") == 0)
+        return true;
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    size_t cap = 4096;
+    uint8_t *buf = malloc(cap);
+    size_t n;
+    while (buf && (n = fread(buf + *len, 1, cap - *len, f)) > 0)
+    {
+        *len += n;
+        if (*len < cap)
+            continue;
+
+        uint8_t *bigger = realloc(buf, cap * 2);
+        if (!bigger)
+        {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        buf = bigger;
+        cap *= 2;
+    }
+    fclose(f);
+
+    if (!buf)
+    {
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+        return false;
+    }
+    *data = buf;
+    return true;
+}
+
+static bool grow_jobs(job_list *list)
+{
+    size_t cap = list->cap ? list->cap * 2 : 64;
+    batch_job_t *jobs = realloc(list->jobs, cap * sizeof(batch_job_t));
+    if (jobs)
+        list->jobs = jobs;
+    uint8_t **inputs = realloc(list->inputs, cap * sizeof(uint8_t *));
+    if (inputs)
+        list->inputs = inputs;
+    if (!jobs || !inputs)
+    {
+        fprintf(stderr, "Error: out of memory growing job list\n");
+        return false;
+    }
+    list->cap = cap;
+    return true;
+}
+
+// Every input file must be readable: a job silently run without its input
+// would look like a plausible io-wait result.
+// Any bad line fails the whole load, so job ids always match line order.
+static bool load_jobs(const char *path, job_list *list, size_t image_count, uint64_t default_budget)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    char line[1024];
+    size_t line_no = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f))
+    {
+        line_no++;
+        char input[900];
+        size_t image;
+        unsigned long long budget = default_budget;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%zu %899s %llu", &image, input, &budget) < 2)
+        {
+            fprintf(stderr, "Error: %s:%zu: bad job line: %s", path, line_no, line);
+            ok = false;
+            break;
+        }
+        if (image >= image_count)
+        {
+            fprintf(stderr, "Error: %s:%zu: image %zu out of range (%zu loaded)\n", path, line_no, image,
+                    image_count);
+            ok = false;
+            break;
+        }
+
+        if (list->count == list->cap && !grow_jobs(list))
+        {
+            ok = false;
+            break;
+        }
+
+        batch_job_t *job = &list->jobs[list->count];
+        if (!read_file(input, &list->inputs[list->count], &job->input_len))
+        {
+            ok = false;
+            break;
+        }
+        job->id = list->count;
+        job->image = image;
+        job->budget = budget;
+        job->input = list->inputs[list->count];
+        list->count++;
+    }
+
+    fclose(f);
+    return ok;
+}
+
+static void collect(const batch_result_t *result, void *arg)
+{
+    FILE *out = arg;
+
+    fprintf(out, "%zu %s %llu ", result->job_id, vm_stop_reason_name(result->reason),
+            (unsigned long long)result->instructions);
+    for (size_t i = 0; i < result->output_len; i++)
+    {
+        uint8_t c = result->output[i];
+        if (c == '\n')
+            fputs("\\n", out);
+        else if (c == '\\')
+            fputs("\\\\", out);
+        else if (c < 0x20 || c >= 0x7F)
+            fprintf(out, "\\x%02X", c);
+        else
+            fputc(c, out);
+    }
+    fputc('\n', out);
+}
+
+int main(int argc, char **argv)
+{
+    batch_image_t images[MAX_IMAGES];
+    size_t image_count = 0;
+    const char *traps = NULL;
+    const char *results = NULL;
+    size_t threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t budget = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:b:t:o:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            budget = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            traps = optarg;
+            break;
+        case 'o':
+            results = optarg;
+            break;
+        case 'p':
+            if (image_count == MAX_IMAGES)
+            {
+                fprintf(stderr, "Error: too many images (max %d)\n", MAX_IMAGES);
+                return 1;
+            }
+            images[image_count].program = assemble_file(optarg);
+            images[image_count].entry = 0x3000;
+            if (!images[image_count].program)
+                return 1;
+            image_count++;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1 || image_count == 0)
+    {
+        usage();
+        return 1;
+    }
+
+    // The OS layer is assembled once and shared by every image.
+    segment_t *os = traps ? assemble_file(traps) : NULL;
+    if (traps && !os)
+        return 1;
+    for (size_t i = 0; i < image_count; i++)
+        images[i].os = os;
+
+    job_list list = {0};
+    if (!load_jobs(argv[optind], &list, image_count, budget))
+        return 1;
+
+    FILE *out = results ? fopen(results, "w") : stdout;
+    if (!out)
+    {
+        perror(results);
+        return 1;
+    }
+
+    batch_runner_t *runner = batch_create(images, image_count, threads, collect, out);
+    if (!runner || !batch_run(runner, list.jobs, list.count))
+    {
+        fprintf(stderr, "Error: batch run failed\n");
+        return 1;
+    }
+
+    batch_destroy(runner);
+    if (out != stdout)
+        fclose(out);
+
+    for (size_t i = 0; i < list.count; i++)
+        free(list.inputs[i]);
+    free(list.inputs);
+    free(list.jobs);
+    for (size_t i = 0; i < image_count; i++)
+        free_segments(images[i].program);
+    free_segments(os);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "pvm/assembler.h"
+#include "pvm/debugmap.h"
+#include "pvm/lockstep.h"
+#include "pvm/memory.h"
+#include "pvm/vm.h"
+
+// lockstep: run a workload under two execution engines and check that they
+// agree instruction for instruction.
+//
+//   lockstep [-t traps.asm] [-e entry] [-a engine] [-B engine] [-i interval] [-b budget] prog.asm [input ...]
+//
+// Engines default to "ref" and "step". Each input file is one run, fed to
+// the keyboard from memory; with none the program runs once without input.
+// States are compared every `interval` instructions (default 10000). One
+// line is printed per agreeing run; a divergence prints a report naming the
+// first differing instruction. Exits 1 if any run diverged.
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: lockstep [-t traps.asm] [-e entry] [-a engine] [-B engine] [-i interval] [-b budget] "
+                    "prog.asm [input ...]\n");
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    size_t cap = 4096;
+    uint8_t *data = malloc(cap);
+    size_t n;
+    *len = 0;
+    while (data && (n = fread(data + *len, 1, cap - *len, f)) > 0)
+    {
+        *len += n;
+        if (*len < cap)
+            continue;
+
+        uint8_t *bigger = realloc(data, cap * 2);
+        if (!bigger)
+        {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = bigger;
+        cap *= 2;
+    }
+    fclose(f);
+
+    if (!data)
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    const char *traps = NULL;
+    const char *names[2] = {"ref", "step"};
+    uint16_t entry = 0x3000;
+    uint64_t interval = 10000;
+    uint64_t budget = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:e:a:B:i:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            traps = optarg;
+            break;
+        case 'e':
+            entry = (uint16_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            names[0] = optarg;
+            break;
+        case 'B':
+            names[1] = optarg;
+            break;
+        case 'i':
+            interval = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            budget = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage();
+        return 1;
+    }
+
+    const vm_engine_t *engines[2];
+    for (int i = 0; i < 2; i++)
+    {
+        engines[i] = vm_engine_find(names[i]);
+        if (!engines[i])
+        {
+            fprintf(stderr, "Error: unknown engine '%s'\n", names[i]);
+            return 1;
+        }
+    }
+
+    debug_map_t *map = debug_map_create();
+    if (!map)
+        return 1;
+
+    segment_t *os = traps ? assemble_file_debug(traps, map) : NULL;
+    segment_t *program = assemble_file_debug(argv[optind], map);
+    if ((traps && !os) || !program)
+        return 1;
+
+    VM *vm = vm_create_sparse();
+    if (!vm)
+        return 1;
+    if (os)
+        vm_load_segments(vm, os);
+    vm_load(vm, program, entry);
+    free_segments(os);
+    free_segments(program);
+
+    vm_snapshot_t *boot = vm_snapshot(vm);
+    vm_lockstep_t *ls = boot ? vm_lockstep_create(boot, engines[0], engines[1]) : NULL;
+    if (!ls)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    int status = 0;
+    int first = optind + 1;
+    for (int i = first; i < argc || (i == first && first == argc); i++)
+    {
+        const char *name = i < argc ? argv[i] : "-";
+        size_t len = 0;
+        uint8_t *input = i < argc ? read_file(argv[i], &len) : NULL;
+        if (i < argc && !input)
+        {
+            status = 1;
+            continue;
+        }
+
+        if (vm_lockstep_run(ls, input, len, interval, budget))
+        {
+            fprintf(stderr, "ok %s: %llu instructions, %llu checks, %s\n", name,
+                    (unsigned long long)(ls->vm[0]->counters.instructions - boot->counters.instructions),
+                    (unsigned long long)ls->checks, ls->vm[0]->halted ? "halted" : "stopped");
+        }
+        else
+        {
+            fprintf(stderr, "FAIL %s\n", name);
+            vm_lockstep_report(ls, map, stderr);
+            status = 1;
+        }
+        free(input);
+    }
+
+    vm_lockstep_destroy(ls);
+    vm_snapshot_release(boot);
+    vm_destroy(vm);
+    debug_map_free(map);
+    return status;
+}
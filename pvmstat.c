@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pvm/stats.h"
+
+// pvmstat: print live rates from a runtime's shared-memory stats segment
+// (vmd -m, or vm_host_set_stats).
+//
+//   pvmstat [-i interval_ms] [-c count] /stats
+//
+// Each line shows rates over the last interval; the first line shows
+// totals since the segment was created. count 0 means run until killed.
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: pvmstat [-i interval_ms] [-c count] /stats\n");
+}
+
+static void print_rates(const uint64_t now[VM_STAT_COUNT], const uint64_t prev[VM_STAT_COUNT], uint64_t elapsed_ns)
+{
+    double secs = elapsed_ns ? (double)elapsed_ns / 1e9 : 1.0;
+
+#define RATE(i) ((double)(now[i] - prev[i]) / secs)
+    printf("%9.2f %10.0f %10.0f %10.0f %8.0f %15llu\n",
+           RATE(VM_STAT_INSTRUCTIONS) / 1e6, RATE(VM_STAT_TRAPS), RATE(VM_STAT_IO_WAITS),
+           RATE(VM_STAT_SLICES), RATE(VM_STAT_HALTS), (unsigned long long)now[VM_STAT_INSTRUCTIONS]);
+#undef RATE
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long interval_ms = 1000;
+    unsigned long count = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            interval_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1 || interval_ms == 0)
+    {
+        usage();
+        return 1;
+    }
+
+    vm_stats_t *stats = vm_stats_open(argv[optind]);
+    if (!stats)
+        return 1;
+
+    uint64_t prev[VM_STAT_COUNT] = {0};
+    uint64_t cur[VM_STAT_COUNT];
+    uint64_t prev_ns = stats->hdr->started_ns;
+
+    printf("pid %u, %u slot(s)\n", stats->hdr->pid, stats->hdr->slot_count);
+    printf("%9s %10s %10s %10s %8s %15s\n", "MIPS", "traps/s", "waits/s", "slices/s", "halts/s", "instructions");
+
+    for (unsigned long n = 0; count == 0 || n < count; n++)
+    {
+        if (n > 0)
+            usleep((useconds_t)(interval_ms * 1000));
+
+        uint64_t t = now_ns();
+        vm_stats_total(stats, cur);
+        print_rates(cur, prev, t - prev_ns);
+        memcpy(prev, cur, sizeof(prev));
+        prev_ns = t;
+    }
+
+    vm_stats_destroy(stats);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "pvm/assembler.h"
+#include "pvm/debugmap.h"
+#include "pvm/snapfile.h"
+#include "pvm/vm.h"
+
+// snap: assemble an image once and save it as a mappable snapshot file.
+//
+//   snap [-t traps.asm] [-e entry] [-n instructions] [-g out.map] prog.asm out.snap
+//
+// With -n the guest runs that many instructions (or until it halts or
+// waits for input) before the state is saved. -g also writes the
+// assembler's debug map (source lines and labels) for the image.
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: snap [-t traps.asm] [-e entry] [-n instructions] [-g out.map] prog.asm out.snap\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *traps = NULL;
+    uint16_t entry = 0x3000;
+    uint64_t warmup = 0;
+    const char *map_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:e:n:g:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            traps = optarg;
+            break;
+        case 'e':
+            entry = (uint16_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            warmup = strtoull(optarg, NULL, 10);
+            break;
+        case 'g':
+            map_path = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+        usage();
+        return 1;
+    }
+
+    debug_map_t *map = map_path ? debug_map_create() : NULL;
+    segment_t *os = traps ? assemble_file_debug(traps, map) : NULL;
+    segment_t *program = assemble_file_debug(argv[optind], map);
+    if ((traps && !os) || !program)
+        return 1;
+
+    if (map)
+    {
+        bool saved = debug_map_save(map, map_path);
+        debug_map_free(map);
+        if (!saved)
+            return 1;
+    }
+
+    VM *vm = vm_create_sparse();
+    if (!vm)
+        return 1;
+    if (os)
+        vm_load_segments(vm, os);
+    vm_load(vm, program, entry);
+    free_segments(os);
+    free_segments(program);
+
+    if (warmup > 0)
+    {
+        vm_stop_reason reason = vm_run_for(vm, warmup);
+        fprintf(stderr, "snap: warm-up stopped (%s) after %llu instructions\n",
+                vm_stop_reason_name(reason), (unsigned long long)vm->counters.instructions);
+    }
+
+    vm_snapshot_t *snapshot = vm_snapshot(vm);
+    bool ok = snapshot && vm_snapshot_save(snapshot, argv[optind + 1]);
+    if (ok)
+        fprintf(stderr, "snap: wrote %s\n", argv[optind + 1]);
+
+    vm_snapshot_release(snapshot);
+    vm_destroy(vm);
+    return ok ? 0 : 1;
+}
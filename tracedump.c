@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "pvm/trace.h"
+
+// tracedump: decode a binary instruction trace into the interpreter's
+// text trace format, oldest record first.
+//
+//   tracedump [-p] trace.bin
+//
+// -p prefixes each instruction with its address.
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tracedump [-p] trace.bin\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool show_pc = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            show_pc = true;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        usage();
+        return 1;
+    }
+
+    vm_trace_t *trace = vm_trace_open(argv[optind]);
+    if (!trace)
+        return 1;
+
+    vm_trace_record_t buf[256];
+    uint64_t cursor = 0;
+    size_t n;
+    while ((n = vm_trace_read(trace, &cursor, buf, sizeof(buf) / sizeof(buf[0]))) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+            vm_trace_format(&buf[i], show_pc, stdout);
+    }
+
+    vm_trace_destroy(trace);
+    return 0;
+}
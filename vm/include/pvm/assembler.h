@@ -19,6 +19,8 @@ typedef struct segment
     struct segment *next; // linked list pointer
 } segment_t;
 
+struct debug_map;
+
 typedef void (*encode_fn_t)(segment_t **ctx, token_line_t *tokens, size_t idx);
 
 typedef struct
@@ -33,6 +35,10 @@ typedef struct
 } instruction_spec_t;
 
 segment_t *assemble(token_line_t *tokens);
+segment_t *assemble_file(const char *path);
+segment_t *assemble_debug(token_line_t *tokens, struct debug_map *map, int file);
+segment_t *assemble_file_debug(const char *path, struct debug_map *map);
+void free_segments(segment_t *ctx);
 instruction_spec_t find_spec(const char *mnemonic);
 segment_t *create_segment(uint16_t origin, size_t capacity);
 segment_t *add_segment(segment_t **ctx, uint16_t origin);
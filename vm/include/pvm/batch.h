@@ -0,0 +1,48 @@
+#ifndef VM_BATCH_H
+#define VM_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+// Pre-assembled guest image: an optional OS layer (trap table and
+// handlers) plus the program, both loaded before every job.
+typedef struct batch_image
+{
+    segment_t *os;
+    segment_t *program;
+    uint16_t entry;
+} batch_image_t;
+
+typedef struct batch_job
+{
+    size_t id;
+    size_t image; // index into the runner's image table
+    const uint8_t *input;
+    size_t input_len;
+    uint64_t budget; // 0 = run until the guest halts or starves
+} batch_job_t;
+
+typedef struct batch_result
+{
+    size_t job_id;
+    vm_stop_reason reason; // VM_STOP_ERROR if job->image is out of range
+    uint64_t instructions;
+    const uint8_t *output; // valid only during the collector callback
+    size_t output_len;
+} batch_result_t;
+
+// Results are delivered one at a time (never concurrently), in completion
+// order, from whichever worker finished the job.
+typedef void (*batch_collect_fn)(const batch_result_t *result, void *arg);
+
+typedef struct batch_runner batch_runner_t;
+
+batch_runner_t *batch_create(const batch_image_t *images, size_t image_count, size_t threads,
+                             batch_collect_fn collect, void *arg);
+void batch_destroy(batch_runner_t *runner);
+bool batch_run(batch_runner_t *runner, const batch_job_t *jobs, size_t job_count);
+
+#endif
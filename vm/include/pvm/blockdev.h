@@ -0,0 +1,52 @@
+#ifndef VM_BLOCKDEV_H
+#define VM_BLOCKDEV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mmio.h"
+
+// Register layout (default base xFE10):
+//   BLKSR   +0  status: bit 15 ready, bit 14 error
+//   BLKSEC  +2  first sector number
+//   BLKADDR +4  guest buffer address
+//   BLKCNT  +6  sector count (0 is treated as 1)
+//   BLKCMD  +8  writing a command starts the transfer
+#define BLK_BASE 0xFE10
+#define BLKSR 0xFE10
+#define BLKSEC 0xFE12
+#define BLKADDR 0xFE14
+#define BLKCNT 0xFE16
+#define BLKCMD 0xFE18
+
+#define BLK_SECTOR_WORDS 256
+
+#define BLK_STATUS_READY 0x8000
+#define BLK_STATUS_ERROR 0x4000
+
+typedef enum
+{
+    BLK_CMD_NONE = 0,
+    BLK_CMD_READ,  // disk -> guest memory
+    BLK_CMD_WRITE, // guest memory -> disk
+    BLK_CMD_FLUSH  // msync the backing file
+} blk_command;
+
+typedef struct blockdev
+{
+    mmio_device_t dev;
+    int fd;
+    uint16_t *data;  // mmap'd file, host-endian 16-bit words
+    size_t sectors;  // whole sectors in the file
+    bool writable;
+    uint16_t status;
+    uint16_t sector;
+    uint16_t address;
+    uint16_t count;
+} blockdev_t;
+
+blockdev_t *blockdev_open(const char *path, bool writable);
+void blockdev_close(blockdev_t *blk);
+bool blockdev_attach(VM *vm, blockdev_t *blk, uint16_t base);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef VM_CALLGRAPH_H
+#define VM_CALLGRAPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+struct debug_map;
+
+// Call-path profiler. The interpreter reports JSR, JSRR and TRAP as calls
+// and RET as a return (only with PVM_PROFILE, and only while
+// vm->callgraph is set); nothing runs per instruction. Instructions are
+// charged to the current call path in bulk at each call or return by
+// reading the retired-instruction clock.
+//
+// Paths form a calling-context tree: node 0 is the context the profiler
+// was created in, and each node is one callee reached from its parent.
+// The shadow stack remembers each call's return address. A RET goes back
+// to the deepest frame whose return address matches the target, which
+// also covers longjmp-style unwinding. A RET that matches no frame is
+// treated as a plain jump, so guests that rewrite R7 skew the profile but
+// cannot break it.
+
+#define VM_CG_MAX_DEPTH 256
+#define VM_CG_MAX_NODES 65536
+
+typedef struct vm_cg_node
+{
+    uint16_t entry;   // callee address
+    uint32_t parent;
+    uint32_t child;   // first child, 0 = none
+    uint32_t sibling; // next child of the parent, 0 = none
+    uint64_t self;    // instructions retired in this path, not in callees
+    uint64_t calls;
+} vm_cg_node_t;
+
+typedef struct vm_cg_frame
+{
+    uint32_t caller;
+    uint16_t ret;
+} vm_cg_frame_t;
+
+typedef struct vm_callgraph
+{
+    const uint64_t *clock;
+    uint64_t last; // clock value already charged
+    vm_cg_node_t *nodes;
+    size_t node_count;
+    size_t node_cap;
+    uint32_t current;
+    vm_cg_frame_t stack[VM_CG_MAX_DEPTH];
+    size_t depth;
+    size_t lost;        // frames deeper than the stack, not tracked
+    uint64_t truncated; // calls charged to their caller for lack of room
+    uint64_t unmatched; // returns that matched no frame
+} vm_callgraph_t;
+
+vm_callgraph_t *vm_callgraph_create(VM *vm);
+void vm_callgraph_destroy(vm_callgraph_t *cg);
+void vm_callgraph_call(vm_callgraph_t *cg, uint16_t entry, uint16_t ret);
+void vm_callgraph_return(vm_callgraph_t *cg, uint16_t target);
+void vm_callgraph_flush(vm_callgraph_t *cg);
+void vm_callgraph_inclusive(vm_callgraph_t *cg, uint64_t *out);
+
+// Folded stacks ("root;caller;callee <self>" per line) for flamegraph.pl
+// and compatible tools, and a table of the heaviest paths. Names come
+// from map when given, otherwise addresses.
+void vm_callgraph_write_folded(vm_callgraph_t *cg, const struct debug_map *map, FILE *out);
+void vm_callgraph_report(vm_callgraph_t *cg, const struct debug_map *map, size_t top, FILE *out);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef VM_CHANNEL_H
+#define VM_CHANNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mmio.h"
+
+// Register layout (default base xFE20):
+//   CHSR   +0  status: bit 15 rx has data, bit 14 tx has space
+//   CHDR   +2  read pops one word from rx, write pushes one word to tx
+//   CHADDR +4  guest buffer address for bulk transfers
+//   CHLEN  +6  words requested; holds words moved after a command
+//   CHCMD  +8  1 = send CHLEN words to tx, 2 = receive up to CHLEN from rx
+//   CHRXSR +10 bit 15 only: rx has data
+//   CHTXSR +12 bit 14 only: tx has space
+//
+// A status read that finds nothing to do suspends the guest until the
+// device is ready again (VM_STOP_IO_WAIT). CHSR waits only while neither
+// bit is set, so a stage with both rings attached should poll the
+// direction it needs through CHRXSR or CHTXSR, which wait on that ring
+// alone.
+#define CH_BASE 0xFE20
+
+#define CH_STATUS_RX_READY 0x8000
+#define CH_STATUS_TX_READY 0x4000
+
+typedef enum
+{
+    CH_CMD_NONE = 0,
+    CH_CMD_SEND,
+    CH_CMD_RECV
+} ch_command;
+
+// Single-producer/single-consumer ring of 16-bit words. The struct lives at
+// the start of a shared mapping so it works between threads of one process
+// and between processes mapping the same shm object.
+typedef struct channel_ring
+{
+    uint32_t magic;
+    uint32_t capacity; // words, power of two
+    uint32_t head __attribute__((aligned(64))); // written by producer only
+    uint32_t tail __attribute__((aligned(64))); // written by consumer only
+    uint16_t data[] __attribute__((aligned(64)));
+} channel_ring_t;
+
+channel_ring_t *channel_create(size_t capacity);
+// With create set, a ring that already exists under name is attached to
+// as it is (its own capacity wins) rather than reset.
+channel_ring_t *channel_open_shm(const char *name, size_t capacity, bool create);
+void channel_release(channel_ring_t *ring);
+void channel_unlink(const char *name);
+
+size_t channel_readable(channel_ring_t *ring);
+size_t channel_writable(channel_ring_t *ring);
+size_t channel_push(channel_ring_t *ring, const uint16_t *src, size_t count);
+size_t channel_pop(channel_ring_t *ring, uint16_t *dst, size_t count);
+
+typedef struct channel_dev
+{
+    mmio_device_t dev;
+    channel_ring_t *rx; // guest reads from here, may be NULL
+    channel_ring_t *tx; // guest writes to here, may be NULL
+    uint16_t address;
+    uint16_t length;
+    uint16_t waiting; // status bits the suspended guest polled for
+} channel_dev_t;
+
+channel_dev_t *channel_device_create(channel_ring_t *rx, channel_ring_t *tx);
+void channel_device_destroy(channel_dev_t *ch);
+bool channel_attach(VM *vm, channel_dev_t *ch, uint16_t base);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef VM_COVERAGE_H
+#define VM_COVERAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+#include "memory.h"
+
+// AFL-style edge coverage for fuzzing guests. While vm->coverage is set
+// (and the build has PVM_COVERAGE), every control transfer - BR taken or
+// not, JMP/RET, JSR/JSRR and TRAP - bumps the map byte for the edge from
+// the previous transfer's target to the new PC. Nothing runs on straight
+// line code.
+//
+// Locations are PCs scrambled by an odd multiplier, which is a bijection
+// on 16 bits, so the map index cur ^ (prev >> 1) only collides between
+// edges, never between blocks. Shifting prev keeps A->B and B->A apart.
+// Counts wrap at 256, as in AFL.
+
+#define VM_COV_SIZE 0x10000
+
+typedef struct vm_coverage
+{
+    uint16_t prev; // previous location, already shifted
+    uint8_t map[VM_COV_SIZE];
+} vm_coverage_t;
+
+static inline void vm_coverage_edge(vm_coverage_t *cov, uint16_t target)
+{
+    uint16_t cur = (uint16_t)(target * 0x9E5Bu);
+    cov->map[cur ^ cov->prev]++;
+    cov->prev = cur >> 1;
+}
+
+vm_coverage_t *vm_coverage_create(void);
+void vm_coverage_destroy(vm_coverage_t *cov);
+void vm_coverage_reset(vm_coverage_t *cov);
+size_t vm_coverage_count(const vm_coverage_t *cov);
+
+// Folds cov into seen, which accumulates hit-count buckets (1, 2, 3, 4-7,
+// 8-15, 16-31, 32-127, 128+) across runs and starts out zeroed. Returns 2
+// if cov reached an edge seen had never hit, 1 if it only hit a known edge
+// a new number of times, else 0.
+int vm_coverage_merge(uint8_t seen[VM_COV_SIZE], const vm_coverage_t *cov);
+
+// One fuzzing execution: restores vm to boot, clears vm->coverage and runs
+// with input fed to the keyboard from memory, discarding output. Runs until
+// HALT, the budget, or the guest polling for input past the end.
+vm_stop_reason vm_coverage_run(VM *vm, vm_snapshot_t *boot, const uint8_t *input, size_t len, uint64_t budget);
+
+#endif
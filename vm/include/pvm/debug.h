@@ -0,0 +1,64 @@
+#ifndef VM_DEBUG_H
+#define VM_DEBUG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+// Breakpoints and watchpoints. Both work through page attributes, so the
+// interpreter's fast paths stay a single attribute test and pages without
+// any point set run at full speed:
+//
+// - A breakpoint marks its page PAGE_BREAK. Fetches from such pages check
+//   the breakpoint bitmap, and a hit ends the slice with
+//   VM_STOP_BREAKPOINT before the instruction executes (PC still points at
+//   it, and the instruction has not been counted). The next vm_run_for
+//   starting at that PC steps over it, so the host resumes by running
+//   again.
+// - A watchpoint marks its page PAGE_WATCHPOINT. Guest loads and stores
+//   on such pages check the watch bitmaps, and a hit lets the instruction
+//   retire, then ends the slice with VM_STOP_WATCHPOINT. Instruction
+//   fetches and host accesses (vm_peek/vm_poke) never trigger them.
+//
+// The last hit is described in `hit`.
+
+#define VM_WATCH_READ 0x1
+#define VM_WATCH_WRITE 0x2
+
+#define VM_DEBUG_NO_RESUME 0x10000
+
+typedef struct
+{
+    uint16_t pc;      // instruction that hit
+    uint16_t address; // word accessed; the PC for breakpoints
+    uint16_t value;   // word loaded or about to be stored
+    uint8_t kind;     // VM_WATCH_READ/WRITE, 0 for breakpoints
+} vm_debug_hit_t;
+
+typedef struct vm_debug
+{
+    VM *vm;
+    uint64_t breaks[0x10000 / 64];
+    uint64_t watch_read[0x10000 / 64];
+    uint64_t watch_write[0x10000 / 64];
+    uint16_t page_breaks[VM_PAGE_COUNT];  // breakpoints set in each page
+    uint16_t page_watches[VM_PAGE_COUNT]; // watched words in each page
+    uint32_t resume;                      // breakpoint to step over, or VM_DEBUG_NO_RESUME
+    vm_debug_hit_t hit;
+} vm_debug_t;
+
+vm_debug_t *vm_debug_attach(VM *vm);
+void vm_debug_detach(vm_debug_t *dbg);
+
+void vm_debug_break(vm_debug_t *dbg, uint16_t address);
+void vm_debug_unbreak(vm_debug_t *dbg, uint16_t address);
+void vm_debug_watch(vm_debug_t *dbg, uint16_t address, size_t count, uint8_t kinds);
+void vm_debug_unwatch(vm_debug_t *dbg, uint16_t address, size_t count);
+
+// Interpreter side, only reached for pages carrying the attributes above.
+bool vm_debug_fetch(vm_debug_t *dbg, uint16_t pc);
+void vm_debug_access(vm_debug_t *dbg, uint16_t address, uint16_t value, uint8_t kind);
+
+#endif
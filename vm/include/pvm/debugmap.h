@@ -0,0 +1,90 @@
+#ifndef VM_DEBUGMAP_H
+#define VM_DEBUGMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Debug map: what the assembler knew about each emitted word. One map can
+// cover several source files (trap table plus program), so line entries
+// carry a file index. Files are loaded in the order they were added, so
+// where two files emit words at the same address the later file wins and
+// debug_map_sort drops the earlier file's lines and labels there.
+//
+// Labels name code and data only within their segment: a run of words one
+// file emitted back to back, usually one .ORIG block. An address ahead of
+// its segment's first label, or outside every segment, has no label.
+
+typedef struct debug_line
+{
+    uint16_t address; // first word emitted by the source line
+    uint16_t words;   // how many words it emitted
+    uint16_t file;    // index into debug_map_t.files
+    int line;         // 1-based source line
+} debug_line_t;
+
+typedef struct debug_label
+{
+    char name[32];
+    uint16_t address;
+    uint16_t file;
+} debug_label_t;
+
+typedef struct debug_segment
+{
+    uint16_t start;
+    uint32_t end; // exclusive
+    uint16_t file;
+} debug_segment_t;
+
+typedef struct debug_map
+{
+    char **files;
+    size_t file_count;
+    debug_line_t *lines;
+    size_t line_count;
+    size_t line_cap;
+    debug_label_t *labels;
+    size_t label_count;
+    size_t label_cap;
+    debug_segment_t *segments; // rebuilt by debug_map_sort
+    size_t segment_count;
+} debug_map_t;
+
+debug_map_t *debug_map_create(void);
+void debug_map_free(debug_map_t *map);
+int debug_map_add_file(debug_map_t *map, const char *path);
+bool debug_map_add_line(debug_map_t *map, uint16_t address, uint16_t words, uint16_t file, int line);
+bool debug_map_add_label(debug_map_t *map, const char *name, uint16_t address, uint16_t file);
+void debug_map_sort(debug_map_t *map);
+
+const debug_line_t *debug_map_line(const debug_map_t *map, uint16_t address);
+const debug_segment_t *debug_map_segment(const debug_map_t *map, uint16_t address);
+const debug_label_t *debug_map_label(const debug_map_t *map, uint16_t address);
+void debug_map_describe(const debug_map_t *map, uint16_t address, char *buf, size_t len);
+
+// Text form, one record per line after a "pvm-debug 1" header:
+//   file <index> <path>
+//   line <address> <words> <file> <line>
+//   label <address> <file> <name>
+bool debug_map_save(const debug_map_t *map, const char *path);
+debug_map_t *debug_map_load(const char *path);
+
+// Ranking shared by the symbolised reports: each entry pairs a count with
+// the index of what it counts (a source line, a label, a call path).
+typedef struct debug_rank
+{
+    uint64_t count;
+    size_t index;
+} debug_rank_t;
+
+void debug_rank_sort(debug_rank_t *ranks, size_t count);
+double debug_percent(uint64_t part, uint64_t total);
+
+// Symbolised profile: folds per-address counts (exact counts from
+// vm_profile_t.pc or samples from vm_sampler_t) into source lines and
+// labels and prints the top entries of each.
+void debug_map_report(const debug_map_t *map, const uint64_t counts[0x10000], size_t top, FILE *out);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef VM_HEATMAP_H
+#define VM_HEATMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct debug_map;
+
+// Guest memory heat map: load and store counts across the whole address
+// space, for deciding data layout. Only data accesses are counted (LD, LDI
+// and its pointer, LDR, ST, STI, STR and the TRAP vector read); fetches
+// belong to the execution profile. Each cell covers 1 << shift words, so
+// shift 0 counts every word and shift 4 every 16-word line. Counting is one
+// increment per access while a map is attached to vm->heatmap, and is
+// compiled out with PVM_PROFILE=0.
+
+#define VM_HEAT_MAX_SHIFT 8
+
+typedef struct vm_heatmap
+{
+    unsigned shift;
+    uint64_t loads[0x10000];  // indexed by address >> shift
+    uint64_t stores[0x10000];
+} vm_heatmap_t;
+
+vm_heatmap_t *vm_heatmap_create(unsigned shift);
+void vm_heatmap_destroy(vm_heatmap_t *heat);
+void vm_heatmap_reset(vm_heatmap_t *heat);
+
+static inline void vm_heatmap_load(vm_heatmap_t *heat, uint16_t address)
+{
+    heat->loads[address >> heat->shift]++;
+}
+
+static inline void vm_heatmap_store(vm_heatmap_t *heat, uint16_t address)
+{
+    heat->stores[address >> heat->shift]++;
+}
+
+// Symbolised report: totals per segment (a run of words the assembler
+// emitted back to back) and per label, the `top` hottest cells, and a
+// picture of the address space at 64 words per character. A cell is
+// attributed to the segment and label of its first word.
+void vm_heatmap_report(const vm_heatmap_t *heat, const struct debug_map *map, size_t top, FILE *out);
+
+// Text form, one touched cell per line after a "pvm-heat 1 <words>" header:
+//   <address> <loads> <stores> [LABEL+off]
+void vm_heatmap_dump(const vm_heatmap_t *heat, const struct debug_map *map, FILE *out);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef VM_HOST_H
+#define VM_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+#define VM_SESSION_BUF 4096
+
+// Event-loop host for many interactive VMs. Each worker thread owns an
+// epoll instance and a share of the sessions; a session runs in slices
+// until it blocks on input, then sleeps until its fd becomes readable.
+
+typedef struct vm_host vm_host_t;
+typedef struct vm_stats vm_stats_t;
+typedef struct vm_host_worker vm_host_worker_t;
+
+typedef struct vm_session
+{
+    VM *vm;
+    int in_fd;
+    int out_fd;
+    uint8_t in_buf[VM_SESSION_BUF];
+    size_t in_pos;
+    size_t in_len;
+    uint8_t out_buf[VM_SESSION_BUF];
+    size_t out_len;
+    bool eof;
+    bool armed;              // in_fd currently registered with epoll
+    bool parked;             // waiting for input on in_fd
+    bool packed;             // VM memory compressed while parked
+    uint64_t parked_at;      // CLOCK_MONOTONIC ms
+    vm_stop_reason result;   // why the session ended
+    void *user;              // caller data, untouched by the host
+    vm_host_worker_t *worker;
+    struct vm_session *next; // run queue / waiter list link
+    struct vm_session *all;  // every session on the worker, for cleanup
+} vm_session_t;
+
+typedef void (*vm_session_exit_fn)(vm_session_t *session, void *arg);
+
+vm_host_t *vm_host_create(size_t threads, uint64_t slice, vm_session_exit_fn on_exit, void *arg);
+void vm_host_destroy(vm_host_t *host);
+void vm_host_set_idle_pack(vm_host_t *host, uint64_t idle_ms);
+void vm_host_set_stats(vm_host_t *host, vm_stats_t *stats);
+vm_session_t *vm_host_add(vm_host_t *host, VM *vm, int in_fd, int out_fd);
+bool vm_host_run(vm_host_t *host);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef VM_IO_H
+#define VM_IO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <termios.h>
+
+// Character I/O backend used by the keyboard and display devices. getc
+// returns the next input byte or -1 when none is ready right now; it must
+// never block. Either callback may be NULL (no input / discard output).
+typedef struct vm_io
+{
+    int (*getc)(void *ctx);
+    void (*putc)(void *ctx, int ch);
+    void *ctx;
+} vm_io_t;
+
+// Terminal backend: raw, non-blocking stdin/stdout. All terminal state is
+// kept here so several VMs or hosts never share hidden globals.
+typedef struct vm_term
+{
+    int in_fd;
+    int out_fd;
+    int saved_flags;
+    struct termios saved_tio;
+    bool is_tty;
+    bool eof;
+} vm_term_t;
+
+bool vm_term_open(vm_term_t *term, int in_fd, int out_fd);
+void vm_term_close(vm_term_t *term);
+bool vm_term_wait(vm_term_t *term, int timeout_ms);
+vm_io_t vm_io_terminal(vm_term_t *term);
+
+// Memory backend: input comes from a fixed buffer, output is appended to a
+// growable buffer owned by the caller (free with vm_membuf_free). With
+// out_max set, output past that many bytes is dropped and truncated set.
+typedef struct vm_membuf
+{
+    const uint8_t *in;
+    size_t in_len;
+    size_t in_pos;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t out_max; // 0 = unbounded
+    bool truncated;
+} vm_membuf_t;
+
+void vm_membuf_init(vm_membuf_t *buf, const uint8_t *in, size_t in_len);
+void vm_membuf_free(vm_membuf_t *buf);
+vm_io_t vm_io_memory(vm_membuf_t *buf);
+
+// Record/replay backends. Input events are keyed by the retired-instruction
+// count at which the guest's poll picked them up (clock normally points at
+// vm->counters.instructions), so a replay takes exactly the same path no
+// matter how fast it runs. The log is text, one "<instruction> <byte>"
+// line per event after a "pvm-input 1" header.
+//
+// Recording wraps any backend. Replay needs no terminal: a poll before the
+// next event's instruction sees no input, and since getc never blocks, the
+// driver should resume straight away on VM_STOP_IO_WAIT until
+// vm_replay_finished() says the log is used up.
+//
+// Closing a recording appends "end <instructions> <output bytes> <digest>"
+// with the clock and a hash of everything the guest printed; once the
+// replay has run to the same point, vm_replay_check compares both.
+typedef struct vm_record
+{
+    vm_io_t inner;
+    const uint64_t *clock;
+    FILE *log;
+    uint64_t out_len;
+    uint64_t out_digest;
+} vm_record_t;
+
+bool vm_record_open(vm_record_t *rec, const char *path, vm_io_t inner, const uint64_t *clock);
+void vm_record_close(vm_record_t *rec);
+vm_io_t vm_io_record(vm_record_t *rec);
+
+typedef struct vm_replay
+{
+    vm_io_t output; // where guest output goes; putc may be NULL
+    const uint64_t *clock;
+    FILE *log;
+    uint64_t next_at; // instruction count of the pending event
+    int next_ch;      // -1 once the log is exhausted
+    uint64_t out_len;
+    uint64_t out_digest;
+    bool has_end; // the log carries the recording's end line
+    uint64_t end_at;
+    uint64_t end_len;
+    uint64_t end_digest;
+} vm_replay_t;
+
+bool vm_replay_open(vm_replay_t *rep, const char *path, vm_io_t output, const uint64_t *clock);
+void vm_replay_close(vm_replay_t *rep);
+bool vm_replay_finished(const vm_replay_t *rep);
+bool vm_replay_check(const vm_replay_t *rep, FILE *out);
+vm_io_t vm_io_replay(vm_replay_t *rep);
+
+#endif
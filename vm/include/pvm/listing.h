@@ -0,0 +1,42 @@
+#ifndef VM_LISTING_H
+#define VM_LISTING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Assembler listings annotated with a static cost model, so the price of
+// a routine can be read off before it runs. Every source line that emits
+// words is listed with its address, encoding and, for instructions, its
+// cost. Summaries follow:
+//
+// - basic blocks: straight-line runs of code, split at labels, branch and
+//   call targets and after every control transfer, with their summed
+//   cost;
+// - loops: each backward BR, with the address range it repeats and
+//   the cost of one pass over that range. A loop that loads device
+//   registers is flagged as polling: LDI through a pointer into the
+//   register window, or LDR off a register last set by LD of such a
+//   pointer in the code just before it;
+// - labels: instruction count, memory accesses and cost of the code up to
+//   the next label or gap, which exposes long save/restore sequences.
+//
+// Costs are per opcode, in abstract cycles. The defaults charge 1 for
+// register operations and branches, 2 for direct memory access and jumps,
+// 3 for indirect access and 4 for TRAP/RTI (not counting the handler).
+
+#define VM_COST_OPCODES 16
+
+typedef struct vm_cost_model
+{
+    uint16_t op[VM_COST_OPCODES];
+} vm_cost_model_t;
+
+void vm_cost_model_default(vm_cost_model_t *model);
+bool vm_cost_model_load(vm_cost_model_t *model, const char *path);
+
+// Assembles path and writes its listing to out. Returns false if the file
+// cannot be read or assembles to nothing.
+bool assemble_listing(const char *path, const vm_cost_model_t *model, FILE *out);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef VM_LOCKSTEP_H
+#define VM_LOCKSTEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "vm.h"
+#include "io.h"
+#include "memory.h"
+
+struct debug_map;
+
+// Differential checking of execution engines. An engine is anything that
+// runs a VM for up to a number of instructions and reports why it stopped,
+// as vm_run_for does. The checker forks two VMs from one snapshot, feeds
+// both the same input from memory and runs them side by side for
+// `interval` instructions at a time. After each interval it compares the
+// register files (PC and COND included), retired counts, halt state, stop
+// reasons, output and a hash of memory. The memory hash is the incremental
+// Zobrist hash from statehash.h, so a check costs a few dozen compares no
+// matter how much memory the guest touched.
+//
+// Engines must be deterministic. On a mismatch the checker replays both
+// sides from the snapshot up to the last interval that matched, then
+// single-steps both and compares after every instruction. That finds the
+// first instruction whose effects differ.
+
+typedef vm_stop_reason (*vm_engine_run_fn)(void *ctx, VM *vm, uint64_t max_instructions);
+
+typedef struct vm_engine
+{
+    const char *name;
+    vm_engine_run_fn run;
+    void *ctx;
+} vm_engine_t;
+
+extern const vm_engine_t vm_engine_reference; // vm_run_for
+extern const vm_engine_t vm_engine_stepped;   // vm_run_for, one instruction per call
+
+const vm_engine_t *vm_engine_find(const char *name);
+
+typedef struct vm_divergence
+{
+    uint64_t instruction; // instructions both sides had retired before it
+    uint16_t pc[2];       // instruction each side executed
+    uint16_t instr[2];
+    bool exact;           // false: stepping did not reproduce it
+    uint16_t reg[2][R_COUNT];
+    uint64_t retired[2];
+    bool halted[2];
+    vm_stop_reason reason[2];
+    size_t out_len[2];
+    bool memory;          // memory differs; first word below
+    uint16_t address;
+    uint16_t value[2];
+} vm_divergence_t;
+
+typedef struct vm_lockstep
+{
+    vm_snapshot_t *boot;
+    vm_engine_t engine[2];
+    VM *vm[2];
+    vm_membuf_t io[2];
+    const uint8_t *input;
+    size_t input_len;
+    uint64_t interval;
+    uint64_t checks; // intervals compared
+    vm_divergence_t divergence;
+} vm_lockstep_t;
+
+vm_lockstep_t *vm_lockstep_create(vm_snapshot_t *boot, const vm_engine_t *a, const vm_engine_t *b);
+void vm_lockstep_destroy(vm_lockstep_t *ls);
+
+// Runs both engines on input until they halt, stop in agreement for
+// another reason, use up the budget, or diverge. Returns true if they
+// agreed the whole way; otherwise ls->divergence says where they parted.
+bool vm_lockstep_run(vm_lockstep_t *ls, const uint8_t *input, size_t len, uint64_t interval, uint64_t budget);
+void vm_lockstep_report(const vm_lockstep_t *ls, const struct debug_map *map, FILE *out);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef VM_MEMORY_H
+#define VM_MEMORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+// Frozen machine state that VMs can be forked from. Page i of a snapshot is
+// either owned by it (bit i of owned set) or borrowed from an ancestor it
+// keeps alive through parent. Snapshots are immutable and reference
+// counted, so any number of threads can fork from one concurrently.
+typedef struct vm_snapshot
+{
+    int refs;
+    uint16_t *pages[VM_PAGE_COUNT];
+    uint64_t owned[VM_PAGE_COUNT / 64];
+    uint16_t reg[R_COUNT];
+    vm_counters_t counters;
+    bool halted;
+    struct vm_snapshot *parent;
+    void *mapping; // file mapping backing the pages, see snapfile.h
+    size_t mapping_len;
+    uint64_t mem_hash; // valid when hash_valid, see statehash.h
+    bool hash_valid;
+} vm_snapshot_t;
+
+// Backs every page that has never been written.
+extern const uint16_t vm_zero_page[VM_PAGE_WORDS];
+
+vm_snapshot_t *vm_snapshot(VM *vm);
+void vm_snapshot_retain(vm_snapshot_t *snap);
+void vm_snapshot_release(vm_snapshot_t *snap);
+
+VM *vm_fork(vm_snapshot_t *snap);
+void vm_restore(VM *vm, vm_snapshot_t *snap);
+bool vm_checkpoint(VM *vm);
+bool vm_reset(VM *vm);
+
+bool vm_page_make_writable(VM *vm, uint8_t page);
+
+size_t vm_pack(VM *vm);
+bool vm_unpack(VM *vm);
+bool vm_page_unpack(VM *vm, uint8_t page);
+
+#endif
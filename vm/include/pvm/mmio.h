@@ -0,0 +1,33 @@
+#ifndef VM_MMIO_H
+#define VM_MMIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+// Device registers live in xFE00-xFFFF; anything below is plain memory.
+#define MMIO_BASE 0xFE00
+
+typedef struct mmio_device mmio_device_t;
+
+typedef uint16_t (*mmio_read_fn_t)(mmio_device_t *dev, VM *vm, uint16_t offset);
+typedef void (*mmio_write_fn_t)(mmio_device_t *dev, VM *vm, uint16_t offset, uint16_t value);
+typedef bool (*mmio_ready_fn_t)(mmio_device_t *dev);
+
+typedef struct mmio_device
+{
+    const char *name;
+    uint16_t base;         // first register address
+    uint16_t size;         // number of words claimed
+    mmio_read_fn_t read;   // offset is relative to base
+    mmio_write_fn_t write; // may be NULL for read-only devices
+    mmio_ready_fn_t ready; // optional, lets a host poll before resuming a waiter
+    void *ctx;             // device private state
+} mmio_device_t;
+
+bool mmio_attach(VM *vm, mmio_device_t *dev);
+void mmio_detach(VM *vm, mmio_device_t *dev);
+mmio_device_t *mmio_find(VM *vm, uint16_t address);
+
+#endif
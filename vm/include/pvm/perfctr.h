@@ -0,0 +1,46 @@
+#ifndef VM_PERFCTR_H
+#define VM_PERFCTR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mmio.h"
+
+// Register layout (default base xFE40). Each counter is 32 bits wide, low
+// word first. Reading a low word latches the high word so the pair is
+// consistent.
+//   PCINSTR  +0/+1  retired instructions
+//   PCLOAD   +2/+3  data loads
+//   PCSTORE  +4/+5  data stores
+//   PCBRANCH +6/+7  taken branches
+//   PCTRAP   +8/+9  TRAP instructions
+//   PCCR     +10    control: bit 0 reset (write only), bit 1 freeze
+#define PC_BASE 0xFE40
+
+#define PCCR_RESET 0x0001
+#define PCCR_FREEZE 0x0002
+
+typedef enum
+{
+    PCTR_INSTRUCTIONS = 0,
+    PCTR_LOADS,
+    PCTR_STORES,
+    PCTR_BRANCHES,
+    PCTR_TRAPS,
+    PCTR_COUNT
+} perfctr_index;
+
+typedef struct perfctr
+{
+    mmio_device_t dev;
+    uint64_t zero[PCTR_COUNT];   // live value at the last reset
+    uint64_t frozen[PCTR_COUNT]; // live value when frozen
+    bool is_frozen;
+    uint16_t latched_hi;
+} perfctr_t;
+
+perfctr_t *perfctr_create(void);
+void perfctr_destroy(perfctr_t *pc);
+bool perfctr_attach(VM *vm, perfctr_t *pc, uint16_t base);
+
+#endif
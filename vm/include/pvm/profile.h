@@ -0,0 +1,47 @@
+#ifndef VM_PROFILE_H
+#define VM_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "mmio.h"
+
+// Execution profile. With PVM_PROFILE=0 the interpreter carries no
+// profiling code at all; otherwise it counts into vm->profile whenever
+// one is attached.
+#ifndef PVM_PROFILE
+#define PVM_PROFILE 1
+#endif
+
+#define PROF_OPCODES 16
+#define PROF_MMIO_REGS (0x10000 - MMIO_BASE)
+
+// Counts since creation or the last vm_profile_reset. opcode[op][1] counts
+// the alternate addressing form: immediate ADD/AND and PC-relative JSR.
+typedef struct vm_profile
+{
+    uint64_t opcode[PROF_OPCODES][2];
+    uint64_t pc[0x10000];
+    uint64_t br_taken[0x10000];
+    uint64_t br_not_taken[0x10000];
+    uint64_t mmio_loads[PROF_MMIO_REGS];
+    uint64_t mmio_stores[PROF_MMIO_REGS];
+    FILE *dump_at_halt; // if set, vm_profile_dump runs when the guest halts
+} vm_profile_t;
+
+vm_profile_t *vm_profile_create(void);
+void vm_profile_destroy(vm_profile_t *prof);
+void vm_profile_reset(vm_profile_t *prof);
+void vm_profile_dump(const vm_profile_t *prof, FILE *out);
+
+static inline void vm_profile_insn(vm_profile_t *prof, uint16_t pc, uint16_t instr)
+{
+    unsigned op = instr >> 12;
+    unsigned alt = (op == 0x1 || op == 0x5) ? (instr >> 5) & 1 : op == 0x4 ? (instr >> 11) & 1 : 0;
+
+    prof->opcode[op][alt]++;
+    prof->pc[pc]++;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef VM_RPC_H
+#define VM_RPC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Wire format spoken between vmd and its clients over a UNIX stream
+// socket. Both ends are on the same host, so fields are host-endian.
+
+#define RPC_MAGIC 0x4C43334A // "LC3J"
+#define RPC_MAX_PAYLOAD (1u << 20)
+#define RPC_DEFAULT_SOCKET "/tmp/vmd.sock"
+
+typedef enum
+{
+    RPC_OK = 0,
+    RPC_BAD_IMAGE,
+    RPC_BAD_REQUEST,
+    RPC_BUSY
+} rpc_status;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t image;
+    uint64_t budget; // 0 = daemon default
+    uint32_t input_len;
+} rpc_request_t;
+
+#define RPC_OUTPUT_TRUNCATED 0x1 // output stopped at RPC_MAX_PAYLOAD bytes
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t status;
+    uint32_t flags;  // RPC_OUTPUT_*
+    uint32_t reason; // vm_stop_reason
+    uint64_t instructions;
+    uint64_t run_ns; // time spent inside vm_run_for
+    uint32_t output_len;
+} rpc_response_t;
+
+bool rpc_write_all(int fd, const void *buf, size_t len);
+bool rpc_read_all(int fd, void *buf, size_t len);
+
+bool rpc_send_request(int fd, const rpc_request_t *req, const uint8_t *input);
+bool rpc_recv_request(int fd, rpc_request_t *req, uint8_t **input);
+bool rpc_send_response(int fd, const rpc_response_t *resp, const uint8_t *output);
+bool rpc_recv_response(int fd, rpc_response_t *resp, uint8_t **output);
+
+int rpc_listen(const char *path);
+int rpc_connect(const char *path);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef VM_SAMPLER_H
+#define VM_SAMPLER_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+// Instruction-count sampling profiler. The sampler drives vm_run_for in
+// chunks and records the guest PC at the end of each one, so the
+// interpreter loop carries no extra work however often it samples. Gaps
+// are jittered around the period so loops whose length divides it are not
+// always caught at the same instruction.
+typedef struct vm_sampler
+{
+    uint64_t period; // mean instructions between samples
+    uint64_t next;   // instructions left until the next sample
+    uint64_t rng;
+    uint64_t total;
+    uint64_t samples[0x10000]; // per guest PC
+} vm_sampler_t;
+
+vm_sampler_t *vm_sampler_create(uint64_t period);
+void vm_sampler_destroy(vm_sampler_t *sampler);
+vm_stop_reason vm_sampler_run(vm_sampler_t *sampler, VM *vm, uint64_t max_instructions);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef VM_SNAPFILE_H
+#define VM_SNAPFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+
+// On-disk snapshot layout, host-endian:
+//
+//   header     snapfile_header_t, zero-padded to header_size
+//   memory     one VM_PAGE_WORDS page per bit set in present, in page order
+//
+// header_size is a multiple of SNAPFILE_ALIGN so the memory section can be
+// mapped straight into a snapshot. Pages that are all zero are omitted and
+// come back as the shared zero page. Device registers that live in guest
+// memory (KBSR, DSR, ...) are saved with it; host-side devices such as a
+// block device's backing file are not, and must be attached again.
+
+#define SNAPFILE_MAGIC 0x534D5650 // "PVMS"
+#define SNAPFILE_VERSION 1
+#define SNAPFILE_ALIGN 4096
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size; // offset of the memory section
+    uint32_t page_words;  // VM_PAGE_WORDS of the writer
+    uint16_t reg[R_COUNT];
+    uint16_t halted;
+    vm_counters_t counters;
+    uint64_t present[VM_PAGE_COUNT / 64];
+} snapfile_header_t;
+
+bool vm_snapshot_save(const vm_snapshot_t *snap, const char *path);
+vm_snapshot_t *vm_snapshot_load(const char *path);
+
+#endif
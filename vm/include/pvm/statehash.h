@@ -0,0 +1,57 @@
+#ifndef VM_STATEHASH_H
+#define VM_STATEHASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+// Incremental state hashing for state-space exploration. Memory is hashed
+// Zobrist-style: the hash is the XOR of vm_hash_word(address, value) over
+// every non-zero word, so a store only has to swap the old word's term for
+// the new one. While hashing is enabled every page carries PAGE_HASH,
+// which sends guest stores through the slow path where vm_poke keeps
+// mem_hash current. Snapshots remember the hash, so restores and resets
+// do not rescan memory. The register file is only a few words and is
+// folded in when the hash is read.
+
+static inline uint64_t vm_hash_word(uint16_t address, uint16_t value)
+{
+    if (value == 0)
+        return 0;
+
+    // splitmix64 finaliser over the (address, value) pair
+    uint64_t x = (((uint64_t)address << 16) | value) + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+void vm_hash_enable(VM *vm);
+void vm_hash_disable(VM *vm);
+uint64_t vm_hash_memory(VM *vm);
+uint64_t vm_state_hash(const VM *vm);
+
+// Visited-state set: open addressing over 64-bit state hashes, 8 bytes per
+// state.
+typedef struct vm_state_set
+{
+    uint64_t *slots; // 0 marks an empty slot
+    size_t cap;      // power of two
+    size_t count;
+} vm_state_set_t;
+
+typedef enum
+{
+    VM_STATE_NEW = 0,  // not seen before, now recorded
+    VM_STATE_SEEN,     // already in the set
+    VM_STATE_NO_MEMORY // the set could not grow; nothing was recorded
+} vm_state_insert_result;
+
+bool vm_state_set_init(vm_state_set_t *set, size_t expected);
+void vm_state_set_free(vm_state_set_t *set);
+vm_state_insert_result vm_state_set_insert(vm_state_set_t *set, uint64_t hash);
+bool vm_state_set_contains(const vm_state_set_t *set, uint64_t hash);
+
+#endif
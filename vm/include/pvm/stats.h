@@ -0,0 +1,77 @@
+#ifndef VM_STATS_H
+#define VM_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+// Live statistics in a named POSIX shared-memory segment, so monitors
+// can watch a running process without stopping or tracing it. Runtimes
+// publish once per slice (a handful of stores), never per instruction.
+//
+// The segment is a header followed by slots of cumulative totals. Each
+// slot is guarded by a sequence counter used as a seqlock. Writers take
+// it by moving it from even to odd and release it by moving it to the
+// next even value, so several threads may share a slot. Readers retry
+// until they see the same even value before and after copying.
+
+#define VM_STATS_MAGIC 0x54535650 // "PVST"
+#define VM_STATS_VERSION 1
+
+typedef enum
+{
+    VM_STAT_INSTRUCTIONS = 0,
+    VM_STAT_LOADS,
+    VM_STAT_STORES,
+    VM_STAT_BRANCHES,
+    VM_STAT_TRAPS,
+    VM_STAT_SLICES,
+    VM_STAT_IO_WAITS, // slices that ended in VM_STOP_IO_WAIT
+    VM_STAT_HALTS,
+    VM_STAT_COUNT
+} vm_stat_index;
+
+typedef struct vm_stats_slot
+{
+    uint32_t seq;
+    uint32_t pad0;
+    uint64_t updated_ns; // CLOCK_MONOTONIC of the last publish
+    uint64_t value[VM_STAT_COUNT];
+    uint8_t pad[48]; // one slot per pair of cache lines
+} vm_stats_slot_t;
+
+typedef struct vm_stats_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t pid;
+    uint32_t pad0;
+    uint64_t started_ns; // CLOCK_MONOTONIC when the segment was created
+    uint8_t pad[96];
+} vm_stats_header_t;
+
+typedef struct vm_stats
+{
+    vm_stats_header_t *hdr;
+    vm_stats_slot_t *slots;
+    size_t map_len;
+    char *name; // set when this process created the segment
+} vm_stats_t;
+
+vm_stats_t *vm_stats_create(const char *name, size_t slots);
+vm_stats_t *vm_stats_open(const char *name);
+void vm_stats_destroy(vm_stats_t *stats);
+
+void vm_stats_publish(vm_stats_t *stats, size_t slot, const uint64_t add[VM_STAT_COUNT]);
+void vm_stats_slice(vm_stats_t *stats, size_t slot, const vm_counters_t *before, const VM *vm,
+                    vm_stop_reason reason);
+
+bool vm_stats_read(const vm_stats_t *stats, size_t slot, uint64_t out[VM_STAT_COUNT]);
+void vm_stats_total(const vm_stats_t *stats, uint64_t out[VM_STAT_COUNT]);
+const char *vm_stat_name(vm_stat_index index);
+
+#endif
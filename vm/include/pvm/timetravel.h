@@ -0,0 +1,32 @@
+#ifndef VM_TIMETRAVEL_H
+#define VM_TIMETRAVEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+// Reverse execution for a single VM. While recording, the VM is
+// checkpointed every `interval` retired instructions (a snapshot, so only
+// pages dirtied since the previous checkpoint are kept), and every guest
+// store (including device DMA into guest memory) and keyboard character is
+// logged with the instruction count at which it happened. Going back
+// restores the nearest earlier checkpoint and replays forward from the
+// logs, so the replay is exact even for interactive guests. Positions are
+// counts of retired instructions.
+//
+// The VM's I/O backend is wrapped at creation; call vm_set_io first.
+// MMIO device registers are not logged, so vm_tt_create refuses a VM that
+// has any device attached (channel, block device, performance counters).
+
+typedef struct vm_tt vm_tt_t;
+
+vm_tt_t *vm_tt_create(VM *vm, uint64_t interval);
+void vm_tt_destroy(vm_tt_t *tt);
+
+vm_stop_reason vm_tt_run_for(vm_tt_t *tt, uint64_t max_instructions);
+bool vm_tt_seek(vm_tt_t *tt, uint64_t position);
+bool vm_tt_step_back(vm_tt_t *tt, uint64_t count);
+bool vm_tt_run_back_to_write(vm_tt_t *tt, uint16_t address);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef VM_TRACE_H
+#define VM_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Execution tracing. PVM_TRACE_LEVEL selects what the interpreter compiles
+// in:
+//   0  nothing; the fast build
+//   1  binary records into the VM's trace ring when one is attached
+//   2  as 1, and each record is also printed to stderr as text
+#ifndef PVM_TRACE_LEVEL
+#define PVM_TRACE_LEVEL 1
+#endif
+
+#define TRACE_MAGIC 0x52545650 // "PVTR"
+#define TRACE_VERSION 1
+
+// Record flags. The low three bits hold R_COND after the instruction.
+#define TRACE_COND_MASK 0x07
+#define TRACE_TAKEN 0x08 // BR was taken
+#define TRACE_HALT 0x10  // TRAP x25
+
+// One retired instruction. What value/addr/aux hold depends on the opcode:
+//   ADD, AND    value = result, aux = first operand, addr = second operand
+//   NOT         value = result, aux = operand
+//   LD/LDI/LDR  value = loaded value, addr = effective address
+//   LEA         value = addr = computed address
+//   ST/STI/STR  value = stored value, addr = effective address
+//   LDR/STR     aux = base register value
+//   STI         aux = address of the pointer
+//   BR/JMP/JSR  value = PC afterwards
+//   TRAP        value = handler address
+typedef struct vm_trace_record
+{
+    uint16_t pc;
+    uint16_t instr;
+    uint16_t value;
+    uint16_t addr;
+    uint16_t aux;
+    uint16_t flags;
+} vm_trace_record_t;
+
+// Shared by the in-memory and file-backed rings; a trace file is this
+// header followed by `capacity` records, so a decoder can read the file of
+// a process that crashed.
+typedef struct vm_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity; // power of two
+    uint64_t head;     // records ever written; the newest is head - 1
+    uint8_t pad[40];   // keep records off the header's cache line
+} vm_trace_header_t;
+
+// Single-writer ring: the VM overwrites the oldest records (flight
+// recorder). Readers in other threads or processes use vm_trace_read,
+// which detects records overwritten under it.
+typedef struct vm_trace
+{
+    vm_trace_header_t *hdr;
+    vm_trace_record_t *records;
+    uint64_t mask;
+    size_t map_len;
+} vm_trace_t;
+
+vm_trace_t *vm_trace_create(size_t capacity, const char *path);
+vm_trace_t *vm_trace_open(const char *path);
+void vm_trace_destroy(vm_trace_t *trace);
+size_t vm_trace_read(const vm_trace_t *trace, uint64_t *cursor, vm_trace_record_t *out, size_t max);
+void vm_trace_format(const vm_trace_record_t *rec, bool show_pc, FILE *out);
+
+static inline void vm_trace_emit(vm_trace_t *trace, uint16_t pc, uint16_t instr, uint16_t value,
+                                 uint16_t addr, uint16_t aux, uint16_t flags)
+{
+    uint64_t head = trace->hdr->head;
+    trace->records[head & trace->mask] = (vm_trace_record_t){pc, instr, value, addr, aux, flags};
+    __atomic_store_n(&trace->hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
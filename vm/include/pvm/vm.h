@@ -4,10 +4,37 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "assembler.h"
+#include "io.h"
 
 #define MAX_STACK_SIZE (1 << 16)
+#define MMIO_MAX_DEVICES 8
+
+// Guest memory is a table of 256-word pages so VMs can share pages
+// copy-on-write with a snapshot.
+#define VM_PAGE_SHIFT 8
+#define VM_PAGE_WORDS (1 << VM_PAGE_SHIFT)
+#define VM_PAGE_COUNT (MAX_STACK_SIZE >> VM_PAGE_SHIFT)
+
+// Per-page attribute bits. A page with no bits set takes the fast path for
+// both reads and writes.
+#define PAGE_SHARED 0x01 // borrowed from the base snapshot, copy before writing
+#define PAGE_MMIO 0x02   // holds device registers
+#define PAGE_CLEAN 0x04  // private copy still equal to the base snapshot
+#define PAGE_WATCH 0x08  // guest stores are reported to the store hook
+#define PAGE_HASH 0x10   // stores update mem_hash, see statehash.h
+#define PAGE_PACKED 0x20 // RLE-compressed while idle, unpacked on access
+#define PAGE_BREAK 0x40  // fetches are checked for breakpoints, see debug.h
+#define PAGE_WATCHPOINT 0x80 // guest loads and stores are checked for watchpoints
+
+// traps.asm's OUT handler. The interpreter runs it natively when fetched,
+// so its page always carries PAGE_BREAK.
+#define VM_NATIVE_OUT 0x0106
+
+struct mmio_device;
+struct vm_snapshot;
 
 typedef enum
 {
@@ -24,12 +51,115 @@ typedef enum
     R_COUNT
 } Registers;
 
+// Primary opcode: bits 15-12 of an instruction word.
+typedef enum
+{
+    OP_BR = 0,
+    OP_ADD,
+    OP_LD,
+    OP_ST,
+    OP_JSR,
+    OP_AND,
+    OP_LDR,
+    OP_STR,
+    OP_RTI,
+    OP_NOT,
+    OP_LDI,
+    OP_STI,
+    OP_JMP,
+    OP_RES,
+    OP_LEA,
+    OP_TRAP,
+    OP_RET = 0xC,
+    OP_INVALID = 0xFFFF
+} OpCode;
+
+typedef enum
+{
+    VM_STOP_NONE = 0,
+    VM_STOP_BUDGET,     // instruction budget used up
+    VM_STOP_HALT,       // guest executed TRAP x25
+    VM_STOP_IO_WAIT,    // guest polled a device that had nothing ready
+    VM_STOP_BREAKPOINT, // a debugger breakpoint was hit
+    VM_STOP_WATCHPOINT, // a watched word was loaded or stored
+    VM_STOP_ERROR,      // the host could not run the VM at all (e.g. a bad image)
+} vm_stop_reason;
+
+typedef enum
+{
+    VM_WAIT_NONE = 0,
+    VM_WAIT_KEYBOARD, // KBSR polled with no key available
+    VM_WAIT_DEVICE,   // an MMIO device reported not-ready
+} vm_wait_kind;
+
+// Describes what a VM stopped with VM_STOP_IO_WAIT is blocked on, so a host
+// can park it until that source becomes ready.
+typedef struct
+{
+    vm_wait_kind kind;
+    uint16_t address;           // register the guest was polling
+    struct mmio_device *device; // VM_WAIT_DEVICE only
+} vm_wait_t;
+
+// Called for every guest store to a PAGE_WATCH page, before it lands.
+typedef struct
+{
+    void (*fn)(void *ctx, uint16_t address, uint16_t value);
+    void *ctx;
+} vm_store_hook_t;
+
+// Retired-event counts, bumped unconditionally by the interpreter.
+typedef struct
+{
+    uint64_t instructions;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t branches; // taken BRs
+    uint64_t traps;
+} vm_counters_t;
+
 typedef struct
 {
-    uint16_t mem[MAX_STACK_SIZE];
+    uint16_t *pages[VM_PAGE_COUNT];
+    uint8_t page_attr[VM_PAGE_COUNT];
+    struct vm_snapshot *base; // owner of every PAGE_SHARED page
+    uint64_t dirty[VM_PAGE_COUNT / 64]; // pages written since base was taken
+    uint64_t mem_hash;                  // maintained while hashing is set
+    bool hashing;
     uint16_t reg[R_COUNT];
+    vm_counters_t counters;
+    vm_io_t io;
+    vm_store_hook_t store_hook;
+    struct vm_trace *trace; // binary instruction trace; NULL = off
+    struct vm_profile *profile; // execution counters; NULL = off
+    struct vm_callgraph *callgraph; // call-path profiler; NULL = off
+    struct vm_heatmap *heatmap; // data access counts; NULL = off
+    struct vm_coverage *coverage; // edge coverage map; NULL = off
+    struct vm_debug *debug; // breakpoints and watchpoints; NULL = none
+    vm_stop_reason stop; // set by handlers/devices to end the current slice
+    vm_wait_t wait;      // valid when the last slice ended in VM_STOP_IO_WAIT
+    bool halted;
+    struct mmio_device *devices[MMIO_MAX_DEVICES];
+    size_t device_count;
 } VM;
 
+VM *vm_create(void);
+VM *vm_create_sparse(void);
+void vm_destroy(VM *vm);
+bool vm_init(VM *vm);
+void vm_init_sparse(VM *vm);
+void vm_release(VM *vm);
+void vm_load(VM *vm, segment_t *segments, uint16_t entry);
+void vm_set_io(VM *vm, vm_io_t io);
+vm_stop_reason vm_run_for(VM *vm, uint64_t max_instructions);
+void vm_wait_on(VM *vm, vm_wait_kind kind, uint16_t address, struct mmio_device *device);
+const char *vm_stop_reason_name(vm_stop_reason reason);
+bool vm_mem_read_block(VM *vm, uint16_t address, uint16_t *dst, size_t count);
+bool vm_mem_write_block(VM *vm, uint16_t address, const uint16_t *src, size_t count);
+uint16_t vm_peek(VM *vm, uint16_t address);
+void vm_poke(VM *vm, uint16_t address, uint16_t value);
+void vm_load_segments(VM *vm, segment_t *segments);
+size_t vm_resident_pages(const VM *vm);
 void load_program(VM *vm, uint16_t *instructions, size_t count);
 void run(VM *vm);
 
@@ -14,6 +14,7 @@
 #include "pvm/symbol.h"
 #include "pvm/vm.h"
 #include "pvm/validator.h"
+#include "pvm/debugmap.h"
 
 // -------------------------------------------------
 // Config / Types
@@ -33,12 +34,25 @@ static bool is_register(const char *str)
 
 static void emit(segment_t **ctx, uint16_t code)
 {
-    if ((*ctx)->pos >= MAX_SIZE)
+    segment_t *seg = *ctx;
+    if (seg->pos >= MAX_SIZE)
     {
-        report_error(0, "Output buffer overflow while emitting code (pos=%zu, size=%zu)\n", (*ctx)->pos, (*ctx)->size);
+        report_error(0, "Output buffer overflow while emitting code (pos=%zu, size=%zu)\n", seg->pos, seg->size);
         return;
     }
-    (*ctx)->data[(*ctx)->pos++] = code;
+    if (seg->pos >= seg->size)
+    {
+        size_t size = seg->size ? seg->size * 2 : 128;
+        uint16_t *data = realloc(seg->data, size * sizeof(uint16_t));
+        if (!data)
+        {
+            report_error(0, "Out of memory while emitting code (pos=%zu)\n", seg->pos);
+            return;
+        }
+        seg->data = data;
+        seg->size = size;
+    }
+    seg->data[seg->pos++] = code;
 }
 
 static int16_t pc_relative_offset(segment_t *ctx, uint16_t target, int bit_count)
@@ -376,10 +390,9 @@ void encode_blkw(segment_t **ctx, token_line_t *tokens, size_t idx)
 {
     token_t *ops = tokens->instr[idx].operands;
     size_t count = (size_t)parse_number(ops[0].value);
-    if ((*ctx)->pos + count > (*ctx)->size)
+    if ((*ctx)->pos + count > MAX_SIZE)
     {
         report_error(idx + 1, ".BLKW exceeds output buffer\n");
-        (*ctx)->pos = (*ctx)->size;
         return;
     }
     for (size_t i = 0; i < count; ++i)
@@ -495,6 +508,13 @@ segment_t *encode_org(segment_t **ctx_head, token_line_t *tokens, size_t idx)
  */
 
 segment_t *assemble(token_line_t *tokens)
+{
+    return assemble_debug(tokens, NULL, 0);
+}
+
+// As assemble, and records into map which words each source line emitted
+// and where every label landed. file is the map's index for this source.
+segment_t *assemble_debug(token_line_t *tokens, debug_map_t *map, int file)
 {
     validate_instruction(tokens);
 
@@ -527,19 +547,79 @@ segment_t *assemble(token_line_t *tokens)
                 report_error(i + 1, "Code before any .ORIG directive\n");
                 continue;
             }
+            size_t start = current->pos;
             ((encode_fn_t)spec.encode_fn)(&current, tokens, i);
+
+            if (map && current->pos > start)
+                debug_map_add_line(map, (uint16_t)(current->origin + start), (uint16_t)(current->pos - start),
+                                   (uint16_t)file, tokens->instr[i].line_number);
         }
     }
 
+    if (map)
+    {
+        for (size_t i = 0; i < tokens->symbol_count; i++)
+            debug_map_add_label(map, tokens->symbols[i]->label, tokens->symbols[i]->address, (uint16_t)file);
+        debug_map_sort(map);
+    }
+
     return head;
 }
 
+// Tokenize and assemble a source file in one go. Returns NULL if the file
+// cannot be opened or produces no segments.
+segment_t *assemble_file(const char *path)
+{
+    return assemble_file_debug(path, NULL);
+}
+
+// As assemble_file, adding the file's lines and labels to map if given.
+segment_t *assemble_file_debug(const char *path, debug_map_t *map)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    token_line_t *lines = calloc(1, sizeof(token_line_t));
+    if (!lines)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    size_t line_count = 0;
+    tokenize_file(f, lines, &line_count);
+    fclose(f);
+
+    int file = map ? debug_map_add_file(map, path) : 0;
+    segment_t *head = assemble_debug(lines, file >= 0 ? map : NULL, file);
+
+    for (size_t i = 0; i < lines->symbol_count; i++)
+        free(lines->symbols[i]);
+    free(lines);
+    return head;
+}
+
+void free_segments(segment_t *ctx)
+{
+    while (ctx)
+    {
+        segment_t *next = ctx->next;
+        free(ctx->data);
+        free(ctx);
+        ctx = next;
+    }
+}
+
 segment_t *create_segment(uint16_t origin, size_t capacity)
 {
     segment_t *seg = malloc(sizeof(segment_t));
     seg->origin = origin;
     seg->data = malloc(capacity * sizeof(uint16_t));
-    seg->size = 0;
+    seg->size = seg->data ? capacity : 0;
     seg->pos = 0;
     seg->next = NULL;
     return seg;
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pvm/batch.h"
+#include "pvm/memory.h"
+
+typedef struct
+{
+    // Chase-Lev deque over job indices. All pushes happen before the
+    // workers start, so only take (owner, bottom end) and steal (thieves,
+    // top end) can race.
+    size_t *slots;
+    int64_t top;
+    int64_t bottom;
+} job_deque;
+
+typedef struct batch_worker
+{
+    batch_runner_t *runner;
+    pthread_t thread;
+    job_deque deque;
+    VM *vm; // reused for every job this worker runs
+    vm_membuf_t io;
+    size_t index;
+} batch_worker_t;
+
+struct batch_runner
+{
+    const batch_image_t *images;
+    vm_snapshot_t **boots; // per image, loaded and parked at the entry point
+    size_t image_count;
+    batch_worker_t *workers;
+    size_t worker_count;
+    const batch_job_t *jobs;
+    batch_collect_fn collect;
+    void *arg;
+    pthread_mutex_t collect_lock;
+};
+
+// -----------------------------------------------------------------------------
+// Deque
+// -----------------------------------------------------------------------------
+
+static bool deque_take(job_deque *d, size_t *out)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+
+    if (t > b)
+    {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    *out = d->slots[b];
+    if (t < b)
+        return true;
+
+    // Last job: race the thieves for it.
+    bool won = __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+static bool deque_steal(job_deque *d, size_t *out)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+    if (t >= b)
+        return false;
+
+    size_t job = d->slots[t];
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return false;
+
+    *out = job;
+    return true;
+}
+
+static bool deque_empty(job_deque *d)
+{
+    return __atomic_load_n(&d->top, __ATOMIC_SEQ_CST) >= __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+}
+
+// -----------------------------------------------------------------------------
+// Workers
+// -----------------------------------------------------------------------------
+
+static void run_job(batch_worker_t *w, const batch_job_t *job)
+{
+    batch_runner_t *r = w->runner;
+    batch_result_t result = {.job_id = job->id, .reason = VM_STOP_ERROR};
+
+    w->io.in = job->input;
+    w->io.in_len = job->input_len;
+    w->io.in_pos = 0;
+    w->io.out_len = 0;
+
+    if (job->image < r->image_count)
+    {
+        VM *vm = w->vm;
+
+        vm_restore(vm, r->boots[job->image]);
+        vm_set_io(vm, vm_io_memory(&w->io));
+
+        // Input is fixed up front, so an I/O wait means the guest has
+        // consumed all of it and the job cannot make further progress.
+        result.reason = vm_run_for(vm, job->budget ? job->budget : UINT64_MAX);
+        result.instructions = vm->counters.instructions;
+    }
+
+    result.output = w->io.out;
+    result.output_len = w->io.out_len;
+
+    pthread_mutex_lock(&r->collect_lock);
+    if (r->collect)
+        r->collect(&result, r->arg);
+    pthread_mutex_unlock(&r->collect_lock);
+}
+
+static bool steal_any(batch_worker_t *w, size_t *job)
+{
+    batch_runner_t *r = w->runner;
+
+    for (;;)
+    {
+        bool all_empty = true;
+        for (size_t i = 1; i < r->worker_count; i++)
+        {
+            batch_worker_t *victim = &r->workers[(w->index + i) % r->worker_count];
+            if (deque_steal(&victim->deque, job))
+                return true;
+            if (!deque_empty(&victim->deque))
+                all_empty = false;
+        }
+        if (all_empty)
+            return false;
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    batch_worker_t *w = arg;
+    size_t job;
+
+    while (deque_take(&w->deque, &job) || steal_any(w, &job))
+        run_job(w, &w->runner->jobs[job]);
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Public API
+// -----------------------------------------------------------------------------
+
+// Loads an image once; every job then forks from the resulting snapshot
+// and only copies the pages it writes.
+static vm_snapshot_t *boot_image(const batch_image_t *img)
+{
+    VM *vm = vm_create_sparse();
+    if (!vm)
+        return NULL;
+
+    if (img->os)
+        vm_load_segments(vm, img->os);
+    vm_load(vm, img->program, img->entry);
+
+    vm_snapshot_t *snap = vm_snapshot(vm);
+    vm_destroy(vm);
+    return snap;
+}
+
+batch_runner_t *batch_create(const batch_image_t *images, size_t image_count, size_t threads,
+                             batch_collect_fn collect, void *arg)
+{
+    if (threads == 0)
+        threads = 1;
+
+    batch_runner_t *r = calloc(1, sizeof(batch_runner_t));
+    if (!r)
+        return NULL;
+
+    r->images = images;
+    r->image_count = image_count;
+    r->collect = collect;
+    r->arg = arg;
+    pthread_mutex_init(&r->collect_lock, NULL);
+
+    r->boots = calloc(image_count ? image_count : 1, sizeof(vm_snapshot_t *));
+    r->workers = calloc(threads, sizeof(batch_worker_t));
+    if (!r->boots || !r->workers)
+    {
+        batch_destroy(r);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < image_count; i++)
+    {
+        r->boots[i] = boot_image(&images[i]);
+        if (!r->boots[i])
+        {
+            batch_destroy(r);
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        batch_worker_t *w = &r->workers[i];
+        w->runner = r;
+        w->index = i;
+        w->vm = vm_create();
+        vm_membuf_init(&w->io, NULL, 0);
+        r->worker_count++;
+        if (!w->vm)
+        {
+            batch_destroy(r);
+            return NULL;
+        }
+    }
+
+    return r;
+}
+
+void batch_destroy(batch_runner_t *r)
+{
+    if (!r)
+        return;
+
+    for (size_t i = 0; i < r->worker_count; i++)
+    {
+        vm_destroy(r->workers[i].vm);
+        vm_membuf_free(&r->workers[i].io);
+        free(r->workers[i].deque.slots);
+    }
+
+    for (size_t i = 0; r->boots && i < r->image_count; i++)
+        vm_snapshot_release(r->boots[i]);
+
+    pthread_mutex_destroy(&r->collect_lock);
+    free(r->boots);
+    free(r->workers);
+    free(r);
+}
+
+bool batch_run(batch_runner_t *r, const batch_job_t *jobs, size_t job_count)
+{
+    r->jobs = jobs;
+
+    // Deal contiguous blocks to each worker; stealing evens out the rest.
+    for (size_t i = 0; i < r->worker_count; i++)
+    {
+        batch_worker_t *w = &r->workers[i];
+        size_t first = job_count * i / r->worker_count;
+        size_t last = job_count * (i + 1) / r->worker_count;
+
+        free(w->deque.slots);
+        w->deque.slots = malloc((last - first + 1) * sizeof(size_t));
+        if (!w->deque.slots)
+            return false;
+
+        w->deque.top = 0;
+        w->deque.bottom = 0;
+        for (size_t j = first; j < last; j++)
+            w->deque.slots[w->deque.bottom++] = j;
+    }
+
+    size_t started = 0;
+    bool ok = true;
+    for (; started < r->worker_count; started++)
+    {
+        if (pthread_create(&r->workers[started].thread, NULL, worker_main, &r->workers[started]) != 0)
+        {
+            perror("Failed to start batch worker");
+            ok = false;
+            break;
+        }
+    }
+
+    // If some threads failed to start, the ones that did will steal the
+    // orphaned deques, so every job still runs.
+    if (started == 0)
+        return false;
+
+    for (size_t i = 0; i < started; i++)
+        pthread_join(r->workers[i].thread, NULL);
+
+    return ok;
+}
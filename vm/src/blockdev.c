@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pvm/blockdev.h"
+
+#define BLK_REG_SR 0
+#define BLK_REG_SEC 2
+#define BLK_REG_ADDR 4
+#define BLK_REG_CNT 6
+#define BLK_REG_CMD 8
+#define BLK_REG_COUNT 10
+
+static void blockdev_transfer(blockdev_t *blk, VM *vm, blk_command cmd)
+{
+    size_t count = blk->count ? blk->count : 1;
+
+    if ((size_t)blk->sector + count > blk->sectors)
+    {
+        blk->status = BLK_STATUS_READY | BLK_STATUS_ERROR;
+        return;
+    }
+
+    uint16_t *disk = blk->data + (size_t)blk->sector * BLK_SECTOR_WORDS;
+    size_t words = count * BLK_SECTOR_WORDS;
+    bool ok = false;
+
+    switch (cmd)
+    {
+    case BLK_CMD_READ:
+        ok = vm_mem_write_block(vm, blk->address, disk, words);
+        break;
+    case BLK_CMD_WRITE:
+        ok = blk->writable && vm_mem_read_block(vm, blk->address, disk, words);
+        break;
+    default:
+        break;
+    }
+
+    blk->status = ok ? BLK_STATUS_READY : BLK_STATUS_READY | BLK_STATUS_ERROR;
+}
+
+static uint16_t blockdev_read(mmio_device_t *dev, VM *vm, uint16_t offset)
+{
+    blockdev_t *blk = dev->ctx;
+    (void)vm;
+
+    switch (offset)
+    {
+    case BLK_REG_SR:
+        return blk->status;
+    case BLK_REG_SEC:
+        return blk->sector;
+    case BLK_REG_ADDR:
+        return blk->address;
+    case BLK_REG_CNT:
+        return blk->count;
+    default:
+        return 0;
+    }
+}
+
+static void blockdev_write(mmio_device_t *dev, VM *vm, uint16_t offset, uint16_t value)
+{
+    blockdev_t *blk = dev->ctx;
+
+    switch (offset)
+    {
+    case BLK_REG_SEC:
+        blk->sector = value;
+        break;
+    case BLK_REG_ADDR:
+        blk->address = value;
+        break;
+    case BLK_REG_CNT:
+        blk->count = value;
+        break;
+    case BLK_REG_CMD:
+        if (value == BLK_CMD_READ || value == BLK_CMD_WRITE)
+        {
+            blockdev_transfer(blk, vm, (blk_command)value);
+        }
+        else if (value == BLK_CMD_FLUSH)
+        {
+            bool ok = !blk->writable ||
+                      msync(blk->data, blk->sectors * BLK_SECTOR_WORDS * sizeof(uint16_t), MS_SYNC) == 0;
+            blk->status = ok ? BLK_STATUS_READY : BLK_STATUS_READY | BLK_STATUS_ERROR;
+        }
+        else
+        {
+            blk->status = BLK_STATUS_READY | BLK_STATUS_ERROR;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+blockdev_t *blockdev_open(const char *path, bool writable)
+{
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Failed to open block device image");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("Failed to stat block device image");
+        close(fd);
+        return NULL;
+    }
+
+    size_t sectors = (size_t)st.st_size / (BLK_SECTOR_WORDS * sizeof(uint16_t));
+    if (sectors == 0)
+    {
+        fprintf(stderr, "Error: block device image '%s' is smaller than one sector\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t length = sectors * BLK_SECTOR_WORDS * sizeof(uint16_t);
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *data = mmap(NULL, length, prot, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("Failed to mmap block device image");
+        close(fd);
+        return NULL;
+    }
+
+    blockdev_t *blk = calloc(1, sizeof(blockdev_t));
+    if (!blk)
+    {
+        munmap(data, length);
+        close(fd);
+        return NULL;
+    }
+
+    blk->fd = fd;
+    blk->data = data;
+    blk->sectors = sectors;
+    blk->writable = writable;
+    blk->status = BLK_STATUS_READY;
+
+    blk->dev = (mmio_device_t){
+        .name = "blockdev",
+        .base = BLK_BASE,
+        .size = BLK_REG_COUNT,
+        .read = blockdev_read,
+        .write = blockdev_write,
+        .ctx = blk};
+
+    return blk;
+}
+
+void blockdev_close(blockdev_t *blk)
+{
+    if (!blk)
+        return;
+    munmap(blk->data, blk->sectors * BLK_SECTOR_WORDS * sizeof(uint16_t));
+    close(blk->fd);
+    free(blk);
+}
+
+bool blockdev_attach(VM *vm, blockdev_t *blk, uint16_t base)
+{
+    blk->dev.base = base;
+    return mmio_attach(vm, &blk->dev);
+}
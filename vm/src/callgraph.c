@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/callgraph.h"
+#include "pvm/debugmap.h"
+
+// -----------------------------------------------------------------------------
+// Shadow stack
+// -----------------------------------------------------------------------------
+
+vm_callgraph_t *vm_callgraph_create(VM *vm)
+{
+    vm_callgraph_t *cg = calloc(1, sizeof(vm_callgraph_t));
+    if (!cg)
+        return NULL;
+
+    cg->node_cap = 256;
+    cg->nodes = calloc(cg->node_cap, sizeof(vm_cg_node_t));
+    if (!cg->nodes)
+    {
+        free(cg);
+        return NULL;
+    }
+
+    cg->clock = &vm->counters.instructions;
+    cg->last = *cg->clock;
+    cg->nodes[0].entry = vm->reg[R_PC];
+    cg->node_count = 1;
+    return cg;
+}
+
+void vm_callgraph_destroy(vm_callgraph_t *cg)
+{
+    if (!cg)
+        return;
+    free(cg->nodes);
+    free(cg);
+}
+
+// Charges everything retired since the last call or return to the
+// current path.
+void vm_callgraph_flush(vm_callgraph_t *cg)
+{
+    uint64_t now = *cg->clock;
+    cg->nodes[cg->current].self += now - cg->last;
+    cg->last = now;
+}
+
+// Child of parent for entry, created on first use. Returns 0 (no node)
+// when the table is full.
+static uint32_t child_node(vm_callgraph_t *cg, uint32_t parent, uint16_t entry)
+{
+    for (uint32_t c = cg->nodes[parent].child; c; c = cg->nodes[c].sibling)
+    {
+        if (cg->nodes[c].entry == entry)
+            return c;
+    }
+
+    if (cg->node_count == cg->node_cap)
+    {
+        if (cg->node_cap == VM_CG_MAX_NODES)
+            return 0;
+
+        vm_cg_node_t *nodes = realloc(cg->nodes, cg->node_cap * 2 * sizeof(vm_cg_node_t));
+        if (!nodes)
+            return 0;
+        cg->nodes = nodes;
+        cg->node_cap *= 2;
+    }
+
+    uint32_t n = (uint32_t)cg->node_count++;
+    cg->nodes[n] = (vm_cg_node_t){.entry = entry, .parent = parent, .sibling = cg->nodes[parent].child};
+    cg->nodes[parent].child = n;
+    return n;
+}
+
+// Called once the call instruction has retired, so it is charged to the
+// caller.
+void vm_callgraph_call(vm_callgraph_t *cg, uint16_t entry, uint16_t ret)
+{
+    vm_callgraph_flush(cg);
+
+    if (cg->depth == VM_CG_MAX_DEPTH)
+    {
+        cg->lost++;
+        cg->truncated++;
+        return;
+    }
+
+    uint32_t callee = child_node(cg, cg->current, entry);
+    cg->stack[cg->depth++] = (vm_cg_frame_t){cg->current, ret};
+    if (!callee)
+    {
+        cg->truncated++;
+        return;
+    }
+
+    cg->nodes[callee].calls++;
+    cg->current = callee;
+}
+
+/*
+ * vm_callgraph_return:
+ *   Unwinds to the deepest frame expecting target. Frames above it were
+ *   abandoned (the guest discarded its return address); a target no frame
+ *   expects is a computed jump through R7 and leaves the stack alone.
+ */
+void vm_callgraph_return(vm_callgraph_t *cg, uint16_t target)
+{
+    vm_callgraph_flush(cg);
+
+    if (cg->lost > 0)
+    {
+        cg->lost--;
+        return;
+    }
+
+    for (size_t i = cg->depth; i-- > 0;)
+    {
+        if (cg->stack[i].ret == target)
+        {
+            cg->current = cg->stack[i].caller;
+            cg->depth = i;
+            return;
+        }
+    }
+    cg->unmatched++;
+}
+
+// Fills out[node] with self plus everything below it. Children are always
+// created after their parent, so one backwards pass suffices.
+void vm_callgraph_inclusive(vm_callgraph_t *cg, uint64_t *out)
+{
+    vm_callgraph_flush(cg);
+
+    for (size_t i = 0; i < cg->node_count; i++)
+        out[i] = cg->nodes[i].self;
+    for (size_t i = cg->node_count; i-- > 1;)
+        out[cg->nodes[i].parent] += out[i];
+}
+
+// -----------------------------------------------------------------------------
+// Export
+// -----------------------------------------------------------------------------
+
+static void print_name(const debug_map_t *map, uint16_t address, FILE *out)
+{
+    const debug_label_t *label = map ? debug_map_label(map, address) : NULL;
+    if (label && label->address == address)
+        fputs(label->name, out);
+    else
+        fprintf(out, "x%04X", address);
+}
+
+static void print_path(const vm_callgraph_t *cg, const debug_map_t *map, uint32_t node, FILE *out)
+{
+    if (node != 0)
+    {
+        print_path(cg, map, cg->nodes[node].parent, out);
+        fputc(';', out);
+    }
+    print_name(map, cg->nodes[node].entry, out);
+}
+
+void vm_callgraph_write_folded(vm_callgraph_t *cg, const debug_map_t *map, FILE *out)
+{
+    vm_callgraph_flush(cg);
+
+    for (uint32_t i = 0; i < cg->node_count; i++)
+    {
+        if (cg->nodes[i].self == 0)
+            continue;
+        print_path(cg, map, i, out);
+        fprintf(out, " %llu\n", (unsigned long long)cg->nodes[i].self);
+    }
+}
+
+void vm_callgraph_report(vm_callgraph_t *cg, const debug_map_t *map, size_t top, FILE *out)
+{
+    uint64_t *inclusive = malloc(cg->node_count * sizeof(uint64_t));
+    debug_rank_t *ranked = malloc(cg->node_count * sizeof(debug_rank_t));
+    if (!inclusive || !ranked)
+    {
+        fprintf(stderr, "Error: out of memory building call graph report\n");
+        free(inclusive);
+        free(ranked);
+        return;
+    }
+
+    vm_callgraph_inclusive(cg, inclusive);
+    for (uint32_t i = 0; i < cg->node_count; i++)
+        ranked[i] = (debug_rank_t){inclusive[i], i};
+    debug_rank_sort(ranked, cg->node_count);
+
+    fprintf(out, "== call paths (%zu paths, %llu instructions)\n", cg->node_count, (unsigned long long)inclusive[0]);
+    fprintf(out, "  %12s %12s %10s  path\n", "inclusive", "exclusive", "calls");
+    for (size_t i = 0; i < cg->node_count && i < top; i++)
+    {
+        const vm_cg_node_t *n = &cg->nodes[ranked[i].index];
+        fprintf(out, "  %12llu %12llu %10llu  ", (unsigned long long)ranked[i].count,
+                (unsigned long long)n->self, (unsigned long long)n->calls);
+        print_path(cg, map, (uint32_t)ranked[i].index, out);
+        fputc('\n', out);
+    }
+    if (cg->truncated || cg->unmatched)
+        fprintf(out, "  (%llu calls charged to their caller, %llu returns matched no call)\n",
+                (unsigned long long)cg->truncated, (unsigned long long)cg->unmatched);
+
+    free(inclusive);
+    free(ranked);
+}
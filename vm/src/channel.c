@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pvm/channel.h"
+
+#define CHANNEL_MAGIC 0x4C433343 // "LC3C"
+
+#define CH_REG_SR 0
+#define CH_REG_DR 2
+#define CH_REG_ADDR 4
+#define CH_REG_LEN 6
+#define CH_REG_CMD 8
+#define CH_REG_RXSR 10
+#define CH_REG_TXSR 12
+#define CH_REG_COUNT 14
+
+#define CH_OPEN_RETRIES 1000 // x 1 ms for a creator to publish the header
+
+// -----------------------------------------------------------------------------
+// Ring
+// -----------------------------------------------------------------------------
+
+static size_t ring_bytes(size_t capacity)
+{
+    return sizeof(channel_ring_t) + capacity * sizeof(uint16_t);
+}
+
+static size_t round_capacity(size_t capacity)
+{
+    size_t cap = 64;
+    while (cap < capacity)
+        cap <<= 1;
+    return cap;
+}
+
+static void ring_init(channel_ring_t *ring, size_t capacity)
+{
+    ring->capacity = (uint32_t)capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    __atomic_store_n(&ring->magic, CHANNEL_MAGIC, __ATOMIC_RELEASE);
+}
+
+channel_ring_t *channel_create(size_t capacity)
+{
+    capacity = round_capacity(capacity);
+    void *mem = mmap(NULL, ring_bytes(capacity), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("Failed to map channel ring");
+        return NULL;
+    }
+
+    channel_ring_t *ring = mem;
+    ring_init(ring, capacity);
+    return ring;
+}
+
+// Waits for a concurrent creator to size the object and publish the
+// header. Returns the ring's capacity, or 0 if it never appears.
+static size_t await_header(int fd, const char *name)
+{
+    for (int attempt = 0; attempt < CH_OPEN_RETRIES; attempt++)
+    {
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            break;
+
+        if ((size_t)st.st_size >= sizeof(channel_ring_t))
+        {
+            channel_ring_t hdr;
+            if (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && hdr.magic == CHANNEL_MAGIC &&
+                ring_bytes(hdr.capacity) == (size_t)st.st_size)
+                return hdr.capacity;
+        }
+        usleep(1000);
+    }
+
+    fprintf(stderr, "Error: channel '%s' is not initialised\n", name);
+    return 0;
+}
+
+channel_ring_t *channel_open_shm(const char *name, size_t capacity, bool create)
+{
+    int fd = -1;
+    if (create)
+    {
+        // Never re-initialise a live ring: a second creator would reset
+        // head and tail under its peers, or shrink their mapping.
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST)
+            create = false;
+    }
+    if (!create)
+        fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0)
+    {
+        perror("Failed to open channel shm");
+        return NULL;
+    }
+
+    if (create)
+    {
+        capacity = round_capacity(capacity);
+        if (ftruncate(fd, ring_bytes(capacity)) < 0)
+        {
+            perror("Failed to size channel shm");
+            close(fd);
+            return NULL;
+        }
+    }
+    else if (!(capacity = await_header(fd, name)))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *mem = mmap(NULL, ring_bytes(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        perror("Failed to map channel shm");
+        return NULL;
+    }
+
+    channel_ring_t *ring = mem;
+    if (create)
+    {
+        ring_init(ring, capacity);
+    }
+    else if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != CHANNEL_MAGIC || ring->capacity != capacity)
+    {
+        fprintf(stderr, "Error: channel '%s' has a bad header\n", name);
+        munmap(mem, ring_bytes(capacity));
+        return NULL;
+    }
+
+    return ring;
+}
+
+void channel_release(channel_ring_t *ring)
+{
+    if (ring)
+        munmap(ring, ring_bytes(ring->capacity));
+}
+
+void channel_unlink(const char *name)
+{
+    shm_unlink(name);
+}
+
+size_t channel_readable(channel_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return head - ring->tail;
+}
+
+size_t channel_writable(channel_ring_t *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return ring->capacity - (ring->head - tail);
+}
+
+// The copy callbacks let the device move words straight between guest
+// memory and ring slots without a bounce buffer.
+typedef bool (*ring_copy_fn)(void *ctx, size_t done, uint16_t *slot, size_t count);
+
+static size_t ring_push(channel_ring_t *ring, size_t count, ring_copy_fn copy, void *ctx)
+{
+    size_t space = channel_writable(ring);
+    if (count > space)
+        count = space;
+
+    uint32_t mask = ring->capacity - 1;
+    uint32_t head = ring->head;
+    size_t first = ring->capacity - (head & mask);
+    if (first > count)
+        first = count;
+
+    if (!copy(ctx, 0, &ring->data[head & mask], first) ||
+        !copy(ctx, first, &ring->data[0], count - first))
+        return 0;
+
+    __atomic_store_n(&ring->head, head + (uint32_t)count, __ATOMIC_RELEASE);
+    return count;
+}
+
+static size_t ring_pop(channel_ring_t *ring, size_t count, ring_copy_fn copy, void *ctx)
+{
+    size_t avail = channel_readable(ring);
+    if (count > avail)
+        count = avail;
+
+    uint32_t mask = ring->capacity - 1;
+    uint32_t tail = ring->tail;
+    size_t first = ring->capacity - (tail & mask);
+    if (first > count)
+        first = count;
+
+    if (!copy(ctx, 0, &ring->data[tail & mask], first) ||
+        !copy(ctx, first, &ring->data[0], count - first))
+        return 0;
+
+    __atomic_store_n(&ring->tail, tail + (uint32_t)count, __ATOMIC_RELEASE);
+    return count;
+}
+
+static bool copy_from_host(void *ctx, size_t done, uint16_t *slot, size_t count)
+{
+    memcpy(slot, (const uint16_t *)ctx + done, count * sizeof(uint16_t));
+    return true;
+}
+
+static bool copy_to_host(void *ctx, size_t done, uint16_t *slot, size_t count)
+{
+    memcpy((uint16_t *)ctx + done, slot, count * sizeof(uint16_t));
+    return true;
+}
+
+size_t channel_push(channel_ring_t *ring, const uint16_t *src, size_t count)
+{
+    return ring_push(ring, count, copy_from_host, (void *)src);
+}
+
+size_t channel_pop(channel_ring_t *ring, uint16_t *dst, size_t count)
+{
+    return ring_pop(ring, count, copy_to_host, dst);
+}
+
+// -----------------------------------------------------------------------------
+// MMIO device
+// -----------------------------------------------------------------------------
+
+typedef struct
+{
+    VM *vm;
+    uint16_t address;
+} guest_span;
+
+static bool copy_from_guest(void *ctx, size_t done, uint16_t *slot, size_t count)
+{
+    guest_span *span = ctx;
+    return count == 0 || vm_mem_read_block(span->vm, span->address + done, slot, count);
+}
+
+static bool copy_to_guest(void *ctx, size_t done, uint16_t *slot, size_t count)
+{
+    guest_span *span = ctx;
+    return count == 0 || vm_mem_write_block(span->vm, span->address + done, slot, count);
+}
+
+static uint16_t channel_status(channel_dev_t *ch)
+{
+    uint16_t status = 0;
+    if (ch->rx && channel_readable(ch->rx) > 0)
+        status |= CH_STATUS_RX_READY;
+    if (ch->tx && channel_writable(ch->tx) > 0)
+        status |= CH_STATUS_TX_READY;
+    return status;
+}
+
+// Resumes a suspended guest once a bit it polled for is set.
+static bool channel_ready(mmio_device_t *dev)
+{
+    channel_dev_t *ch = dev->ctx;
+    return (channel_status(ch) & ch->waiting) != 0;
+}
+
+static uint16_t poll_status(channel_dev_t *ch, VM *vm, uint16_t address, uint16_t wanted)
+{
+    uint16_t status = channel_status(ch) & wanted;
+    if (status == 0)
+    {
+        ch->waiting = wanted;
+        vm_wait_on(vm, VM_WAIT_DEVICE, address, &ch->dev);
+    }
+    return status;
+}
+
+static uint16_t channel_read(mmio_device_t *dev, VM *vm, uint16_t offset)
+{
+    channel_dev_t *ch = dev->ctx;
+
+    switch (offset)
+    {
+    case CH_REG_SR:
+        return poll_status(ch, vm, dev->base + offset, CH_STATUS_RX_READY | CH_STATUS_TX_READY);
+    case CH_REG_RXSR:
+        return poll_status(ch, vm, dev->base + offset, CH_STATUS_RX_READY);
+    case CH_REG_TXSR:
+        return poll_status(ch, vm, dev->base + offset, CH_STATUS_TX_READY);
+    case CH_REG_DR:
+    {
+        uint16_t word = 0;
+        if (ch->rx)
+            channel_pop(ch->rx, &word, 1);
+        return word;
+    }
+    case CH_REG_ADDR:
+        return ch->address;
+    case CH_REG_LEN:
+        return ch->length;
+    default:
+        return 0;
+    }
+}
+
+static void channel_write(mmio_device_t *dev, VM *vm, uint16_t offset, uint16_t value)
+{
+    channel_dev_t *ch = dev->ctx;
+
+    switch (offset)
+    {
+    case CH_REG_DR:
+        if (ch->tx)
+            channel_push(ch->tx, &value, 1);
+        break;
+    case CH_REG_ADDR:
+        ch->address = value;
+        break;
+    case CH_REG_LEN:
+        ch->length = value;
+        break;
+    case CH_REG_CMD:
+    {
+        guest_span span = {vm, ch->address};
+        size_t moved = 0;
+
+        if (value == CH_CMD_SEND && ch->tx)
+            moved = ring_push(ch->tx, ch->length, copy_from_guest, &span);
+        else if (value == CH_CMD_RECV && ch->rx)
+            moved = ring_pop(ch->rx, ch->length, copy_to_guest, &span);
+
+        ch->length = (uint16_t)moved;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+channel_dev_t *channel_device_create(channel_ring_t *rx, channel_ring_t *tx)
+{
+    channel_dev_t *ch = calloc(1, sizeof(channel_dev_t));
+    if (!ch)
+        return NULL;
+
+    ch->rx = rx;
+    ch->tx = tx;
+    ch->dev = (mmio_device_t){
+        .name = "channel",
+        .base = CH_BASE,
+        .size = CH_REG_COUNT,
+        .read = channel_read,
+        .write = channel_write,
+        .ready = channel_ready,
+        .ctx = ch};
+
+    return ch;
+}
+
+void channel_device_destroy(channel_dev_t *ch)
+{
+    free(ch);
+}
+
+bool channel_attach(VM *vm, channel_dev_t *ch, uint16_t base)
+{
+    ch->dev.base = base;
+    return mmio_attach(vm, &ch->dev);
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/coverage.h"
+#include "pvm/io.h"
+
+vm_coverage_t *vm_coverage_create(void)
+{
+    return calloc(1, sizeof(vm_coverage_t));
+}
+
+void vm_coverage_destroy(vm_coverage_t *cov)
+{
+    free(cov);
+}
+
+void vm_coverage_reset(vm_coverage_t *cov)
+{
+    memset(cov->map, 0, sizeof(cov->map));
+    cov->prev = 0;
+}
+
+// Number of distinct edges hit since the last reset.
+size_t vm_coverage_count(const vm_coverage_t *cov)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < VM_COV_SIZE; i++)
+        count += cov->map[i] != 0;
+    return count;
+}
+
+static uint8_t bucket(uint8_t hits)
+{
+    if (hits <= 3)
+        return hits == 3 ? 0x04 : hits; // 0, 1, 2 map to themselves
+    if (hits <= 7)
+        return 0x08;
+    if (hits <= 15)
+        return 0x10;
+    if (hits <= 31)
+        return 0x20;
+    if (hits <= 127)
+        return 0x40;
+    return 0x80;
+}
+
+int vm_coverage_merge(uint8_t seen[VM_COV_SIZE], const vm_coverage_t *cov)
+{
+    static uint8_t buckets[256];
+    static bool ready;
+    int result = 0;
+
+    if (!ready)
+    {
+        for (int i = 0; i < 256; i++)
+            buckets[i] = bucket((uint8_t)i);
+        ready = true;
+    }
+
+    // Most of the map is zero; skip it eight bytes at a time.
+    for (size_t i = 0; i < VM_COV_SIZE; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &cov->map[i], sizeof(word));
+        if (!word)
+            continue;
+
+        for (size_t j = i; j < i + 8; j++)
+        {
+            uint8_t b = buckets[cov->map[j]];
+            if (b & ~seen[j])
+            {
+                if (!seen[j])
+                    result = 2;
+                else if (result == 0)
+                    result = 1;
+                seen[j] |= b;
+            }
+        }
+    }
+    return result;
+}
+
+/*
+ * vm_coverage_run:
+ *   Input is all there up front, so an I/O wait means the guest has read
+ *   past its end and the run is over, as in the batch runner. The VM's
+ *   own backend is put back afterwards.
+ */
+vm_stop_reason vm_coverage_run(VM *vm, vm_snapshot_t *boot, const uint8_t *input, size_t len, uint64_t budget)
+{
+    vm_membuf_t buf;
+    vm_membuf_init(&buf, input, len);
+
+    vm_io_t io = vm_io_memory(&buf);
+    io.putc = NULL; // output is not needed for coverage
+
+    vm_io_t saved_io = vm->io;
+    vm_restore(vm, boot);
+    vm->io = io;
+    if (vm->coverage)
+        vm_coverage_reset(vm->coverage);
+
+    vm_stop_reason reason = vm_run_for(vm, budget ? budget : UINT64_MAX);
+
+    vm->io = saved_io;
+    vm_membuf_free(&buf);
+    return reason;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/debug.h"
+
+#define PAGE_OF(addr) ((uint8_t)((addr) >> VM_PAGE_SHIFT))
+
+static inline bool test_bit(const uint64_t *bits, uint16_t address)
+{
+    return (bits[address / 64] >> (address % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t *bits, uint16_t address)
+{
+    bits[address / 64] |= 1ULL << (address % 64);
+}
+
+static inline void clear_bit(uint64_t *bits, uint16_t address)
+{
+    bits[address / 64] &= ~(1ULL << (address % 64));
+}
+
+// -----------------------------------------------------------------------------
+// Setup
+// -----------------------------------------------------------------------------
+
+vm_debug_t *vm_debug_attach(VM *vm)
+{
+    vm_debug_t *dbg = calloc(1, sizeof(vm_debug_t));
+    if (!dbg)
+        return NULL;
+
+    dbg->vm = vm;
+    dbg->resume = VM_DEBUG_NO_RESUME;
+    vm->debug = dbg;
+    return dbg;
+}
+
+// Removes every point and detaches from the VM.
+void vm_debug_detach(vm_debug_t *dbg)
+{
+    if (!dbg)
+        return;
+
+    for (uint32_t a = 0; a < 0x10000; a++)
+    {
+        if (test_bit(dbg->breaks, (uint16_t)a))
+            vm_debug_unbreak(dbg, (uint16_t)a);
+    }
+    vm_debug_unwatch(dbg, 0, 0x10000);
+
+    dbg->vm->debug = NULL;
+    free(dbg);
+}
+
+void vm_debug_break(vm_debug_t *dbg, uint16_t address)
+{
+    if (test_bit(dbg->breaks, address))
+        return;
+
+    set_bit(dbg->breaks, address);
+    dbg->page_breaks[PAGE_OF(address)]++;
+    dbg->vm->page_attr[PAGE_OF(address)] |= PAGE_BREAK;
+}
+
+// The native OUT handler's page keeps PAGE_BREAK for the interpreter.
+void vm_debug_unbreak(vm_debug_t *dbg, uint16_t address)
+{
+    uint8_t page = PAGE_OF(address);
+    if (!test_bit(dbg->breaks, address))
+        return;
+
+    clear_bit(dbg->breaks, address);
+    if (--dbg->page_breaks[page] == 0 && page != PAGE_OF(VM_NATIVE_OUT))
+        dbg->vm->page_attr[page] &= ~PAGE_BREAK;
+    if (dbg->resume == address)
+        dbg->resume = VM_DEBUG_NO_RESUME;
+}
+
+// Watches count words from address for the given VM_WATCH_* kinds, adding
+// to any kinds already watched there. Wraps at the top of memory.
+void vm_debug_watch(vm_debug_t *dbg, uint16_t address, size_t count, uint8_t kinds)
+{
+    for (size_t i = 0; i < count && i < 0x10000; i++)
+    {
+        uint16_t a = (uint16_t)(address + i);
+        bool was_watched = test_bit(dbg->watch_read, a) || test_bit(dbg->watch_write, a);
+
+        if (kinds & VM_WATCH_READ)
+            set_bit(dbg->watch_read, a);
+        if (kinds & VM_WATCH_WRITE)
+            set_bit(dbg->watch_write, a);
+
+        if (!was_watched && (kinds & (VM_WATCH_READ | VM_WATCH_WRITE)))
+        {
+            dbg->page_watches[PAGE_OF(a)]++;
+            dbg->vm->page_attr[PAGE_OF(a)] |= PAGE_WATCHPOINT;
+        }
+    }
+}
+
+void vm_debug_unwatch(vm_debug_t *dbg, uint16_t address, size_t count)
+{
+    for (size_t i = 0; i < count && i < 0x10000; i++)
+    {
+        uint16_t a = (uint16_t)(address + i);
+        if (!test_bit(dbg->watch_read, a) && !test_bit(dbg->watch_write, a))
+            continue;
+
+        clear_bit(dbg->watch_read, a);
+        clear_bit(dbg->watch_write, a);
+        if (--dbg->page_watches[PAGE_OF(a)] == 0)
+            dbg->vm->page_attr[PAGE_OF(a)] &= ~PAGE_WATCHPOINT;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Interpreter side
+// -----------------------------------------------------------------------------
+
+/*
+ * vm_debug_fetch:
+ *   Returns true if the instruction at pc must not run because it is a
+ *   breakpoint. The first fetch after stopping there is let through, so
+ *   resuming executes the instruction instead of stopping again.
+ */
+bool vm_debug_fetch(vm_debug_t *dbg, uint16_t pc)
+{
+    if (!test_bit(dbg->breaks, pc))
+        return false;
+
+    if (dbg->resume == pc)
+    {
+        dbg->resume = VM_DEBUG_NO_RESUME;
+        return false;
+    }
+
+    dbg->resume = pc;
+    dbg->hit = (vm_debug_hit_t){.pc = pc, .address = pc, .value = 0, .kind = 0};
+    return true;
+}
+
+// A guest load or store on a watched page. Accesses happen while the PC
+// still points just past the instruction making them.
+void vm_debug_access(vm_debug_t *dbg, uint16_t address, uint16_t value, uint8_t kind)
+{
+    const uint64_t *bits = kind == VM_WATCH_READ ? dbg->watch_read : dbg->watch_write;
+    if (!test_bit(bits, address))
+        return;
+
+    dbg->hit = (vm_debug_hit_t){
+        .pc = (uint16_t)(dbg->vm->reg[R_PC] - 1), .address = address, .value = value, .kind = kind};
+    dbg->vm->stop = VM_STOP_WATCHPOINT;
+}
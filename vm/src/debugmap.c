@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/debugmap.h"
+
+#define DEBUG_MAP_HEADER "pvm-debug 1"
+
+// -----------------------------------------------------------------------------
+// Building
+// -----------------------------------------------------------------------------
+
+debug_map_t *debug_map_create(void)
+{
+    return calloc(1, sizeof(debug_map_t));
+}
+
+void debug_map_free(debug_map_t *map)
+{
+    if (!map)
+        return;
+    for (size_t i = 0; i < map->file_count; i++)
+        free(map->files[i]);
+    free(map->files);
+    free(map->lines);
+    free(map->labels);
+    free(map->segments);
+    free(map);
+}
+
+// Returns the file's index, or -1 if out of memory.
+int debug_map_add_file(debug_map_t *map, const char *path)
+{
+    char **files = realloc(map->files, (map->file_count + 1) * sizeof(char *));
+    if (!files)
+        return -1;
+    map->files = files;
+
+    char *copy = malloc(strlen(path) + 1);
+    if (!copy)
+        return -1;
+    strcpy(copy, path);
+
+    map->files[map->file_count] = copy;
+    return (int)map->file_count++;
+}
+
+bool debug_map_add_line(debug_map_t *map, uint16_t address, uint16_t words, uint16_t file, int line)
+{
+    if (map->line_count == map->line_cap)
+    {
+        size_t cap = map->line_cap ? map->line_cap * 2 : 64;
+        debug_line_t *lines = realloc(map->lines, cap * sizeof(debug_line_t));
+        if (!lines)
+        {
+            fprintf(stderr, "Error: out of memory growing debug map\n");
+            return false;
+        }
+        map->lines = lines;
+        map->line_cap = cap;
+    }
+
+    map->lines[map->line_count++] = (debug_line_t){address, words, file, line};
+    return true;
+}
+
+bool debug_map_add_label(debug_map_t *map, const char *name, uint16_t address, uint16_t file)
+{
+    if (map->label_count == map->label_cap)
+    {
+        size_t cap = map->label_cap ? map->label_cap * 2 : 32;
+        debug_label_t *labels = realloc(map->labels, cap * sizeof(debug_label_t));
+        if (!labels)
+        {
+            fprintf(stderr, "Error: out of memory growing debug map\n");
+            return false;
+        }
+        map->labels = labels;
+        map->label_cap = cap;
+    }
+
+    debug_label_t *label = &map->labels[map->label_count++];
+    strncpy(label->name, name, sizeof(label->name) - 1);
+    label->name[sizeof(label->name) - 1] = '\0';
+    label->address = address;
+    label->file = file;
+    return true;
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+    const debug_line_t *x = a, *y = b;
+    if (x->address != y->address)
+        return (int)x->address - (int)y->address;
+    return (int)x->file - (int)y->file;
+}
+
+static int compare_labels(const void *a, const void *b)
+{
+    const debug_label_t *x = a, *y = b;
+    if (x->address != y->address)
+        return (int)x->address - (int)y->address;
+    return (int)x->file - (int)y->file;
+}
+
+// Groups the sorted lines into runs of adjacent words from one file.
+static bool build_segments(debug_map_t *map)
+{
+    free(map->segments);
+    map->segment_count = 0;
+    map->segments = malloc((map->line_count + 1) * sizeof(debug_segment_t));
+    if (!map->segments)
+    {
+        fprintf(stderr, "Error: out of memory growing debug map\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < map->line_count; i++)
+    {
+        const debug_line_t *l = &map->lines[i];
+        if (!l->words)
+            continue;
+
+        debug_segment_t *last = map->segment_count ? &map->segments[map->segment_count - 1] : NULL;
+        if (last && last->end == l->address && last->file == l->file)
+        {
+            last->end += l->words;
+            continue;
+        }
+        map->segments[map->segment_count++] = (debug_segment_t){l->address, (uint32_t)l->address + l->words, l->file};
+    }
+    return true;
+}
+
+/*
+ * debug_map_sort:
+ *   Orders lines and labels by address and resolves overlaps between
+ *   files: a line that shares words with a later file's line is dropped
+ *   whole, as is a label sitting inside a later file's code. Then splits
+ *   the lines into segments.
+ */
+void debug_map_sort(debug_map_t *map)
+{
+    qsort(map->lines, map->line_count, sizeof(debug_line_t), compare_lines);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < map->line_count; i++)
+    {
+        debug_line_t cur = map->lines[i];
+        bool shadowed = false;
+
+        while (kept > 0)
+        {
+            const debug_line_t *prev = &map->lines[kept - 1];
+            if (cur.address >= (uint32_t)prev->address + prev->words)
+                break;
+            if (prev->file > cur.file)
+            {
+                shadowed = true;
+                break;
+            }
+            kept--;
+        }
+
+        if (!shadowed)
+            map->lines[kept++] = cur;
+    }
+    map->line_count = kept;
+
+    qsort(map->labels, map->label_count, sizeof(debug_label_t), compare_labels);
+
+    kept = 0;
+    for (size_t i = 0; i < map->label_count; i++)
+    {
+        const debug_line_t *line = debug_map_line(map, map->labels[i].address);
+        if (!line || line->file <= map->labels[i].file)
+            map->labels[kept++] = map->labels[i];
+    }
+    map->label_count = kept;
+
+    build_segments(map);
+}
+
+// -----------------------------------------------------------------------------
+// Lookup
+// -----------------------------------------------------------------------------
+
+// Source line whose words cover address, or NULL.
+const debug_line_t *debug_map_line(const debug_map_t *map, uint16_t address)
+{
+    size_t lo = 0, hi = map->line_count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (map->lines[mid].address <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return NULL;
+    const debug_line_t *entry = &map->lines[lo - 1];
+    return address < (uint32_t)entry->address + entry->words ? entry : NULL;
+}
+
+// Segment whose words cover address, or NULL.
+const debug_segment_t *debug_map_segment(const debug_map_t *map, uint16_t address)
+{
+    size_t lo = 0, hi = map->segment_count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (map->segments[mid].start <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo && address < map->segments[lo - 1].end ? &map->segments[lo - 1] : NULL;
+}
+
+// Closest label at or below address within its segment, or NULL.
+const debug_label_t *debug_map_label(const debug_map_t *map, uint16_t address)
+{
+    const debug_segment_t *seg = debug_map_segment(map, address);
+    if (!seg)
+        return NULL;
+
+    size_t lo = 0, hi = map->label_count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (map->labels[mid].address <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo && map->labels[lo - 1].address >= seg->start ? &map->labels[lo - 1] : NULL;
+}
+
+// Formats address as "LABEL+off (file:line)", leaving out what is unknown.
+void debug_map_describe(const debug_map_t *map, uint16_t address, char *buf, size_t len)
+{
+    const debug_label_t *label = debug_map_label(map, address);
+    const debug_line_t *line = debug_map_line(map, address);
+    int n;
+
+    if (label && label->address == address)
+        n = snprintf(buf, len, "%s", label->name);
+    else if (label)
+        n = snprintf(buf, len, "%s+%u", label->name, (unsigned)(address - label->address));
+    else
+        n = snprintf(buf, len, "x%04X", address);
+
+    if (line && n >= 0 && (size_t)n < len)
+        snprintf(buf + n, len - (size_t)n, " (%s:%d)", map->files[line->file], line->line);
+}
+
+// -----------------------------------------------------------------------------
+// File form
+// -----------------------------------------------------------------------------
+
+bool debug_map_save(const debug_map_t *map, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    fprintf(f, DEBUG_MAP_HEADER "\n");
+    for (size_t i = 0; i < map->file_count; i++)
+        fprintf(f, "file %zu %s\n", i, map->files[i]);
+    for (size_t i = 0; i < map->line_count; i++)
+    {
+        const debug_line_t *l = &map->lines[i];
+        fprintf(f, "line x%04X %u %u %d\n", l->address, l->words, l->file, l->line);
+    }
+    for (size_t i = 0; i < map->label_count; i++)
+        fprintf(f, "label x%04X %u %s\n", map->labels[i].address, map->labels[i].file, map->labels[i].name);
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Error: failed to write debug map %s\n", path);
+    return ok;
+}
+
+debug_map_t *debug_map_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    debug_map_t *map = debug_map_create();
+    char buf[512];
+    bool ok = map && fgets(buf, sizeof(buf), f) && strncmp(buf, DEBUG_MAP_HEADER, strlen(DEBUG_MAP_HEADER)) == 0;
+
+    while (ok && fgets(buf, sizeof(buf), f))
+    {
+        unsigned address, words, file;
+        int line, off;
+        char name[64];
+
+        buf[strcspn(buf, "\n")] = '\0';
+        if (sscanf(buf, "file %u %n", &file, &off) == 1)
+            ok = file == map->file_count && debug_map_add_file(map, buf + off) >= 0;
+        else if (sscanf(buf, "line x%x %u %u %d", &address, &words, &file, &line) == 4)
+            ok = file < map->file_count && debug_map_add_line(map, (uint16_t)address, (uint16_t)words, (uint16_t)file, line);
+        else if (sscanf(buf, "label x%x %u %63s", &address, &file, name) == 3)
+            ok = file < map->file_count && debug_map_add_label(map, name, (uint16_t)address, (uint16_t)file);
+        else
+            ok = false;
+    }
+    fclose(f);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Error: %s is not a valid debug map\n", path);
+        debug_map_free(map);
+        return NULL;
+    }
+
+    debug_map_sort(map);
+    return map;
+}
+
+// -----------------------------------------------------------------------------
+// Report
+// -----------------------------------------------------------------------------
+
+static int compare_ranks(const void *a, const void *b)
+{
+    const debug_rank_t *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Highest count first; equal counts keep index order.
+void debug_rank_sort(debug_rank_t *ranks, size_t count)
+{
+    qsort(ranks, count, sizeof(debug_rank_t), compare_ranks);
+}
+
+double debug_percent(uint64_t part, uint64_t total)
+{
+    return total ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+/*
+ * debug_map_report:
+ *   Folds counts into source lines and labels and prints the top entries
+ *   of each. Counts at addresses the map does not cover are reported as
+ *   one "<unmapped>" bucket so nothing silently drops out of the total.
+ */
+void debug_map_report(const debug_map_t *map, const uint64_t counts[0x10000], size_t top, FILE *out)
+{
+    uint64_t total = 0;
+    for (uint32_t a = 0; a < 0x10000; a++)
+        total += counts[a];
+
+    // Lines
+    debug_rank_t *ranked = calloc(map->line_count + map->label_count + 1, sizeof(debug_rank_t));
+    if (!ranked)
+    {
+        fprintf(stderr, "Error: out of memory building profile report\n");
+        return;
+    }
+
+    uint64_t mapped = 0;
+    for (size_t i = 0; i < map->line_count; i++)
+    {
+        const debug_line_t *l = &map->lines[i];
+        ranked[i].index = i;
+        for (uint32_t a = l->address; a < (uint32_t)l->address + l->words && a < 0x10000; a++)
+            ranked[i].count += counts[a];
+        mapped += ranked[i].count;
+    }
+    debug_rank_sort(ranked, map->line_count);
+
+    fprintf(out, "== hot source lines (%llu total)\n", (unsigned long long)total);
+    for (size_t i = 0; i < map->line_count && i < top && ranked[i].count; i++)
+    {
+        const debug_line_t *l = &map->lines[ranked[i].index];
+        char where[96];
+        debug_map_describe(map, l->address, where, sizeof(where));
+        fprintf(out, "  %12llu %5.1f%%  %s:%d  x%04X %s\n", (unsigned long long)ranked[i].count,
+                debug_percent(ranked[i].count, total), map->files[l->file], l->line, l->address, where);
+    }
+    if (total > mapped)
+        fprintf(out, "  %12llu %5.1f%%  <unmapped>\n", (unsigned long long)(total - mapped),
+                debug_percent(total - mapped, total));
+
+    // Labels: every count belongs to the closest label at or below it in
+    // its segment. The last slot collects addresses that have none.
+    memset(ranked, 0, (map->label_count + 1) * sizeof(debug_rank_t));
+    for (size_t i = 0; i <= map->label_count; i++)
+        ranked[i].index = i;
+    for (uint32_t a = 0; a < 0x10000; a++)
+    {
+        if (!counts[a])
+            continue;
+        const debug_label_t *label = debug_map_label(map, (uint16_t)a);
+        ranked[label ? (size_t)(label - map->labels) : map->label_count].count += counts[a];
+    }
+    debug_rank_sort(ranked, map->label_count + 1);
+
+    fprintf(out, "== hot labels\n");
+    for (size_t i = 0; i <= map->label_count && i < top && ranked[i].count; i++)
+    {
+        const char *name = ranked[i].index < map->label_count ? map->labels[ranked[i].index].name : "<no label>";
+        fprintf(out, "  %12llu %5.1f%%  %s\n", (unsigned long long)ranked[i].count,
+                debug_percent(ranked[i].count, total), name);
+    }
+
+    free(ranked);
+}
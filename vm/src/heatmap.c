@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/heatmap.h"
+#include "pvm/debugmap.h"
+#include "pvm/mmio.h"
+
+vm_heatmap_t *vm_heatmap_create(unsigned shift)
+{
+    if (shift > VM_HEAT_MAX_SHIFT)
+    {
+        fprintf(stderr, "Error: heat map cells can be at most %u words\n", 1u << VM_HEAT_MAX_SHIFT);
+        return NULL;
+    }
+
+    vm_heatmap_t *heat = calloc(1, sizeof(vm_heatmap_t));
+    if (!heat)
+    {
+        fprintf(stderr, "Error: out of memory allocating heat map\n");
+        return NULL;
+    }
+    heat->shift = shift;
+    return heat;
+}
+
+void vm_heatmap_destroy(vm_heatmap_t *heat)
+{
+    free(heat);
+}
+
+void vm_heatmap_reset(vm_heatmap_t *heat)
+{
+    memset(heat->loads, 0, sizeof(heat->loads));
+    memset(heat->stores, 0, sizeof(heat->stores));
+}
+
+// -----------------------------------------------------------------------------
+// Report
+// -----------------------------------------------------------------------------
+
+// One character per 64 words, rising roughly with the log of the count.
+static void print_picture(const vm_heatmap_t *heat, FILE *out)
+{
+    static const char levels[] = " .:-=+*#%@";
+    enum { WORDS_PER_CHAR = 64, CHARS_PER_ROW = 64 };
+    uint64_t sums[0x10000 / WORDS_PER_CHAR] = {0};
+    uint64_t max = 0;
+
+    for (size_t ch = 0; ch < 0x10000 / WORDS_PER_CHAR; ch++)
+    {
+        size_t first = (ch * WORDS_PER_CHAR) >> heat->shift;
+        size_t last = ((ch + 1) * WORDS_PER_CHAR - 1) >> heat->shift;
+        for (size_t c = first; c <= last; c++)
+            sums[ch] += heat->loads[c] + heat->stores[c];
+        if (sums[ch] > max)
+            max = sums[ch];
+    }
+
+    unsigned max_bits = 0;
+    while (max >> max_bits)
+        max_bits++;
+
+    fprintf(out, "== address space (64 words per character, '@' = %llu accesses)\n", (unsigned long long)max);
+    for (size_t row = 0; row < 0x10000 / WORDS_PER_CHAR / CHARS_PER_ROW; row++)
+    {
+        char line[CHARS_PER_ROW + 1];
+        for (size_t col = 0; col < CHARS_PER_ROW; col++)
+        {
+            uint64_t v = sums[row * CHARS_PER_ROW + col];
+            unsigned bits = 0;
+            while (v >> bits)
+                bits++;
+            line[col] = levels[v ? 1 + bits * 8 / max_bits : 0];
+        }
+        line[CHARS_PER_ROW] = '\0';
+        fprintf(out, "  x%04X |%s|\n", (unsigned)(row * WORDS_PER_CHAR * CHARS_PER_ROW), line);
+    }
+}
+
+/*
+ * vm_heatmap_report:
+ *   Folds the cells into the debug map's segments and labels, then lists
+ *   the hottest cells and draws the address space. Accesses outside every
+ *   segment are split into device registers and "<unmapped>" (stack, heap,
+ *   anything the program did not assemble), so the totals always add up.
+ */
+void vm_heatmap_report(const vm_heatmap_t *heat, const debug_map_t *map, size_t top, FILE *out)
+{
+    size_t cells = 0x10000 >> heat->shift;
+    uint16_t words = (uint16_t)(1u << heat->shift);
+    size_t slots = map->segment_count > map->label_count ? map->segment_count : map->label_count;
+
+    // One extra slot: addresses outside every segment, or with no label.
+    uint64_t *seg_loads = calloc(map->segment_count + 1, sizeof(uint64_t));
+    uint64_t *seg_stores = calloc(map->segment_count + 1, sizeof(uint64_t));
+    uint64_t *label_loads = calloc(map->label_count + 1, sizeof(uint64_t));
+    uint64_t *label_stores = calloc(map->label_count + 1, sizeof(uint64_t));
+    debug_rank_t *ranked = calloc(cells > slots + 1 ? cells : slots + 1, sizeof(debug_rank_t));
+    if (!seg_loads || !seg_stores || !label_loads || !label_stores || !ranked)
+    {
+        fprintf(stderr, "Error: out of memory building heat map report\n");
+        free(seg_loads);
+        free(seg_stores);
+        free(label_loads);
+        free(label_stores);
+        free(ranked);
+        return;
+    }
+
+    uint64_t loads = 0, stores = 0;
+    uint64_t device[2] = {0, 0};
+
+    for (size_t c = 0; c < cells; c++)
+    {
+        if (!heat->loads[c] && !heat->stores[c])
+            continue;
+
+        uint16_t address = (uint16_t)(c << heat->shift);
+        loads += heat->loads[c];
+        stores += heat->stores[c];
+
+        const debug_segment_t *seg = debug_map_segment(map, address);
+        if (!seg && address >= MMIO_BASE)
+        {
+            device[0] += heat->loads[c];
+            device[1] += heat->stores[c];
+            continue;
+        }
+        size_t s = seg ? (size_t)(seg - map->segments) : map->segment_count;
+        seg_loads[s] += heat->loads[c];
+        seg_stores[s] += heat->stores[c];
+        if (!seg)
+            continue;
+
+        const debug_label_t *label = debug_map_label(map, address);
+        size_t l = label ? (size_t)(label - map->labels) : map->label_count;
+        label_loads[l] += heat->loads[c];
+        label_stores[l] += heat->stores[c];
+    }
+    uint64_t total = loads + stores;
+
+    // Segments
+    for (size_t s = 0; s < map->segment_count; s++)
+        ranked[s] = (debug_rank_t){seg_loads[s] + seg_stores[s], s};
+    debug_rank_sort(ranked, map->segment_count);
+
+    fprintf(out, "== memory heat by segment (%llu loads, %llu stores, %u-word cells)\n", (unsigned long long)loads,
+            (unsigned long long)stores, words);
+    fprintf(out, "  %12s %12s %6s\n", "loads", "stores", "");
+    for (size_t i = 0; i < map->segment_count && ranked[i].count; i++)
+    {
+        size_t s = ranked[i].index;
+        const debug_segment_t *seg = &map->segments[s];
+        fprintf(out, "  %12llu %12llu %5.1f%%  x%04X-x%04X %s\n", (unsigned long long)seg_loads[s],
+                (unsigned long long)seg_stores[s], debug_percent(ranked[i].count, total), (unsigned)seg->start,
+                (unsigned)(seg->end - 1), map->files[seg->file]);
+    }
+    size_t none = map->segment_count;
+    if (seg_loads[none] + seg_stores[none])
+        fprintf(out, "  %12llu %12llu %5.1f%%  <unmapped>\n", (unsigned long long)seg_loads[none],
+                (unsigned long long)seg_stores[none], debug_percent(seg_loads[none] + seg_stores[none], total));
+    if (device[0] + device[1])
+        fprintf(out, "  %12llu %12llu %5.1f%%  <devices>\n", (unsigned long long)device[0],
+                (unsigned long long)device[1], debug_percent(device[0] + device[1], total));
+
+    // Labels
+    for (size_t l = 0; l <= map->label_count; l++)
+        ranked[l] = (debug_rank_t){label_loads[l] + label_stores[l], l};
+    debug_rank_sort(ranked, map->label_count + 1);
+
+    fprintf(out, "== memory heat by label\n");
+    for (size_t i = 0; i <= map->label_count && i < top && ranked[i].count; i++)
+    {
+        size_t l = ranked[i].index;
+        const char *name = l < map->label_count ? map->labels[l].name : "<no label>";
+        fprintf(out, "  %12llu %12llu %5.1f%%  %s\n", (unsigned long long)label_loads[l],
+                (unsigned long long)label_stores[l], debug_percent(ranked[i].count, total), name);
+    }
+
+    // Cells
+    size_t touched = 0;
+    for (size_t c = 0; c < cells; c++)
+    {
+        if (heat->loads[c] || heat->stores[c])
+            ranked[touched++] = (debug_rank_t){heat->loads[c] + heat->stores[c], c};
+    }
+    debug_rank_sort(ranked, touched);
+
+    fprintf(out, "== hottest %s (%zu touched)\n", words == 1 ? "words" : "lines", touched);
+    for (size_t i = 0; i < touched && i < top; i++)
+    {
+        size_t c = ranked[i].index;
+        uint16_t address = (uint16_t)(c << heat->shift);
+        char where[96];
+        debug_map_describe(map, address, where, sizeof(where));
+        fprintf(out, "  %12llu %12llu %5.1f%%  x%04X %s\n", (unsigned long long)heat->loads[c],
+                (unsigned long long)heat->stores[c], debug_percent(ranked[i].count, total), address, where);
+    }
+
+    print_picture(heat, out);
+
+    free(seg_loads);
+    free(seg_stores);
+    free(label_loads);
+    free(label_stores);
+    free(ranked);
+}
+
+void vm_heatmap_dump(const vm_heatmap_t *heat, const debug_map_t *map, FILE *out)
+{
+    fprintf(out, "pvm-heat 1 %u\n", 1u << heat->shift);
+    for (size_t c = 0; c < (0x10000u >> heat->shift); c++)
+    {
+        if (!heat->loads[c] && !heat->stores[c])
+            continue;
+
+        uint16_t address = (uint16_t)(c << heat->shift);
+        fprintf(out, "x%04X %llu %llu", address, (unsigned long long)heat->loads[c],
+                (unsigned long long)heat->stores[c]);
+
+        const debug_label_t *label = map ? debug_map_label(map, address) : NULL;
+        if (label && label->address == address)
+            fprintf(out, " %s", label->name);
+        else if (label)
+            fprintf(out, " %s+%u", label->name, (unsigned)(address - label->address));
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "pvm/host.h"
+#include "pvm/memory.h"
+#include "pvm/mmio.h"
+#include "pvm/stats.h"
+
+#define HOST_MAX_EVENTS 64
+#define HOST_DEVICE_POLL_MS 1
+
+struct vm_host_worker
+{
+    vm_host_t *host;
+    pthread_t thread;
+    int epfd;
+    vm_session_t *run_head;
+    vm_session_t *run_tail;
+    vm_session_t *device_waiters;
+    vm_session_t *sessions;
+    size_t live;
+    size_t parked_unpacked; // candidates for the idle packer
+};
+
+struct vm_host
+{
+    vm_host_worker_t *workers;
+    size_t worker_count;
+    size_t next_worker;
+    uint64_t slice;
+    uint64_t idle_ms; // pack VMs parked this long; 0 = never
+    vm_stats_t *stats; // live stats, one slot per worker; NULL = off
+    pthread_mutex_t start_lock; // held by vm_host_run until every worker is placed
+    vm_session_exit_fn on_exit;
+    void *arg;
+};
+
+// -----------------------------------------------------------------------------
+// Session I/O
+// -----------------------------------------------------------------------------
+
+static void session_flush(vm_session_t *s)
+{
+    size_t done = 0;
+    while (done < s->out_len)
+    {
+        ssize_t n = write(s->out_fd, s->out_buf + done, s->out_len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // peer gone; drop the output
+        done += (size_t)n;
+    }
+    s->out_len = 0;
+}
+
+static int session_getc(void *ctx)
+{
+    vm_session_t *s = ctx;
+    if (s->in_pos >= s->in_len)
+        return -1;
+    return s->in_buf[s->in_pos++];
+}
+
+static void session_putc(void *ctx, int ch)
+{
+    vm_session_t *s = ctx;
+    if (s->out_len == sizeof(s->out_buf))
+        session_flush(s);
+    s->out_buf[s->out_len++] = (uint8_t)ch;
+}
+
+// Pull whatever the fd has into the input buffer without blocking.
+static size_t session_fill(vm_session_t *s)
+{
+    if (s->in_pos == s->in_len)
+        s->in_pos = s->in_len = 0;
+
+    size_t space = sizeof(s->in_buf) - s->in_len;
+    if (space == 0 || s->eof)
+        return 0;
+
+    ssize_t n = read(s->in_fd, s->in_buf + s->in_len, space);
+    if (n == 0)
+        s->eof = true;
+    if (n <= 0)
+        return 0;
+
+    s->in_len += (size_t)n;
+    return (size_t)n;
+}
+
+// -----------------------------------------------------------------------------
+// Scheduling
+// -----------------------------------------------------------------------------
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void push_runnable(vm_host_worker_t *w, vm_session_t *s)
+{
+    s->next = NULL;
+    if (w->run_tail)
+        w->run_tail->next = s;
+    else
+        w->run_head = s;
+    w->run_tail = s;
+}
+
+static void finish(vm_host_worker_t *w, vm_session_t *s, vm_stop_reason reason)
+{
+    if (s->armed)
+    {
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->in_fd, NULL);
+        s->armed = false;
+    }
+    s->result = reason;
+    w->live--;
+    if (w->host->on_exit)
+        w->host->on_exit(s, w->host->arg);
+}
+
+static void park_on_input(vm_host_worker_t *w, vm_session_t *s)
+{
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = s};
+    int op = s->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(w->epfd, op, s->in_fd, &ev) < 0)
+    {
+        // Regular files cannot be polled; they are always readable.
+        push_runnable(w, s);
+        return;
+    }
+    s->armed = true;
+    s->parked = true;
+    s->parked_at = now_ms();
+    w->parked_unpacked++;
+}
+
+// Woken sessions need nothing undone: packed pages come back one at a
+// time as the guest touches them.
+static void unpark(vm_host_worker_t *w, vm_session_t *s)
+{
+    if (!s->parked)
+        return;
+    if (!s->packed)
+        w->parked_unpacked--;
+    s->parked = false;
+    s->packed = false;
+}
+
+// Compresses sessions that have sat parked past the idle threshold and
+// returns how long until the next one is due, or -1 if none are waiting.
+static int pack_idle(vm_host_worker_t *w)
+{
+    uint64_t idle = w->host->idle_ms;
+    if (idle == 0 || w->parked_unpacked == 0)
+        return -1;
+
+    uint64_t now = now_ms();
+    uint64_t next = UINT64_MAX;
+    for (vm_session_t *s = w->sessions; s; s = s->all)
+    {
+        if (!s->parked || s->packed)
+            continue;
+
+        if (now - s->parked_at >= idle)
+        {
+            vm_pack(s->vm);
+            s->packed = true;
+            w->parked_unpacked--;
+        }
+        else if (s->parked_at + idle < next)
+        {
+            next = s->parked_at + idle;
+        }
+    }
+    return next == UINT64_MAX ? -1 : (int)(next - now);
+}
+
+static void session_step(vm_host_worker_t *w, vm_session_t *s)
+{
+    vm_counters_t before = s->vm->counters;
+    vm_stop_reason reason = vm_run_for(s->vm, w->host->slice);
+    session_flush(s);
+
+    if (w->host->stats)
+        vm_stats_slice(w->host->stats, (size_t)(w - w->host->workers), &before, s->vm, reason);
+
+    switch (reason)
+    {
+    case VM_STOP_BUDGET:
+        push_runnable(w, s);
+        break;
+
+    case VM_STOP_IO_WAIT:
+        if (s->vm->wait.kind == VM_WAIT_DEVICE)
+        {
+            s->next = w->device_waiters;
+            w->device_waiters = s;
+        }
+        else if (s->in_pos < s->in_len || session_fill(s) > 0)
+        {
+            push_runnable(w, s);
+        }
+        else if (s->eof)
+        {
+            finish(w, s, VM_STOP_IO_WAIT);
+        }
+        else
+        {
+            park_on_input(w, s);
+        }
+        break;
+
+    default:
+        finish(w, s, reason);
+        break;
+    }
+}
+
+static void poll_device_waiters(vm_host_worker_t *w)
+{
+    vm_session_t **link = &w->device_waiters;
+    while (*link)
+    {
+        vm_session_t *s = *link;
+        mmio_device_t *dev = s->vm->wait.device;
+        if (!dev || !dev->ready || dev->ready(dev))
+        {
+            *link = s->next;
+            push_runnable(w, s);
+        }
+        else
+        {
+            link = &s->next;
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    vm_host_worker_t *w = arg;
+    struct epoll_event events[HOST_MAX_EVENTS];
+
+    // Wait until vm_host_run knows which workers started; the others'
+    // sessions may be handed to this one first.
+    pthread_mutex_lock(&w->host->start_lock);
+    pthread_mutex_unlock(&w->host->start_lock);
+
+    while (w->live > 0)
+    {
+        // Each pass gives every runnable session one slice, so sessions
+        // queued during the pass wait for the next one (round robin).
+        vm_session_t *batch = w->run_head;
+        w->run_head = w->run_tail = NULL;
+        while (batch)
+        {
+            vm_session_t *s = batch;
+            batch = s->next;
+            session_step(w, s);
+        }
+
+        poll_device_waiters(w);
+        if (w->live == 0)
+            break;
+
+        int pack_due = pack_idle(w);
+        int timeout = w->run_head ? 0 : w->device_waiters ? HOST_DEVICE_POLL_MS : pack_due;
+        int n = epoll_wait(w->epfd, events, HOST_MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++)
+        {
+            vm_session_t *s = events[i].data.ptr;
+            unpark(w, s);
+            session_fill(s);
+            push_runnable(w, s);
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Public API
+// -----------------------------------------------------------------------------
+
+vm_host_t *vm_host_create(size_t threads, uint64_t slice, vm_session_exit_fn on_exit, void *arg)
+{
+    if (threads == 0)
+        threads = 1;
+
+    vm_host_t *host = calloc(1, sizeof(vm_host_t));
+    if (!host)
+        return NULL;
+
+    host->workers = calloc(threads, sizeof(vm_host_worker_t));
+    if (!host->workers)
+    {
+        free(host);
+        return NULL;
+    }
+
+    pthread_mutex_init(&host->start_lock, NULL);
+    host->worker_count = threads;
+    host->slice = slice ? slice : 10000;
+    host->on_exit = on_exit;
+    host->arg = arg;
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        host->workers[i].host = host;
+        host->workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (host->workers[i].epfd < 0)
+        {
+            perror("Failed to create epoll instance");
+            host->worker_count = i;
+            vm_host_destroy(host);
+            return NULL;
+        }
+    }
+
+    return host;
+}
+
+void vm_host_destroy(vm_host_t *host)
+{
+    if (!host)
+        return;
+
+    for (size_t i = 0; i < host->worker_count; i++)
+    {
+        vm_host_worker_t *w = &host->workers[i];
+        vm_session_t *s = w->sessions;
+        while (s)
+        {
+            vm_session_t *next = s->all;
+            free(s);
+            s = next;
+        }
+        close(w->epfd);
+    }
+
+    pthread_mutex_destroy(&host->start_lock);
+    free(host->workers);
+    free(host);
+}
+
+// Sessions parked on input for idle_ms or longer have their VM memory
+// compressed with vm_pack; 0 turns this off.
+void vm_host_set_idle_pack(vm_host_t *host, uint64_t idle_ms)
+{
+    host->idle_ms = idle_ms;
+}
+
+// Publishes per-slice counters to stats, worker i into slot i (modulo the
+// slot count). NULL turns publishing off.
+void vm_host_set_stats(vm_host_t *host, vm_stats_t *stats)
+{
+    host->stats = stats;
+}
+
+vm_session_t *vm_host_add(vm_host_t *host, VM *vm, int in_fd, int out_fd)
+{
+    vm_session_t *s = calloc(1, sizeof(vm_session_t));
+    if (!s)
+        return NULL;
+
+    int flags = fcntl(in_fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(in_fd, F_SETFL, flags | O_NONBLOCK);
+
+    vm_host_worker_t *w = &host->workers[host->next_worker++ % host->worker_count];
+
+    s->vm = vm;
+    s->in_fd = in_fd;
+    s->out_fd = out_fd;
+    s->worker = w;
+    s->all = w->sessions;
+    w->sessions = s;
+    w->live++;
+
+    vm_set_io(vm, (vm_io_t){.getc = session_getc, .putc = session_putc, .ctx = s});
+    push_runnable(w, s);
+    return s;
+}
+
+// Hands every session of `from` to `to`. Only valid before either runs,
+// while sessions are all queued and none is registered with epoll.
+static void move_sessions(vm_host_worker_t *from, vm_host_worker_t *to)
+{
+    vm_session_t *s = from->sessions;
+    while (s)
+    {
+        vm_session_t *next = s->all;
+        s->worker = to;
+        s->all = to->sessions;
+        to->sessions = s;
+        push_runnable(to, s);
+        s = next;
+    }
+    to->live += from->live;
+    from->sessions = from->run_head = from->run_tail = NULL;
+    from->live = 0;
+}
+
+/*
+ * vm_host_run:
+ *   Runs every session to completion. Sessions must be added beforehand.
+ *   Workers hold off until all threads are created; if some cannot be,
+ *   their sessions are dealt to the ones that did start (or, if none did,
+ *   run on the calling thread), so no session is dropped. Returns false in
+ *   that case to report the lost parallelism.
+ */
+bool vm_host_run(vm_host_t *host)
+{
+    size_t started = 0;
+    bool ok = true;
+
+    pthread_mutex_lock(&host->start_lock);
+    for (; started < host->worker_count; started++)
+    {
+        int rc = pthread_create(&host->workers[started].thread, NULL, worker_main, &host->workers[started]);
+        if (rc != 0)
+        {
+            fprintf(stderr, "Error: failed to start host worker: %s\n", strerror(rc));
+            ok = false;
+            break;
+        }
+    }
+
+    size_t runners = started ? started : 1;
+    for (size_t i = runners; i < host->worker_count; i++)
+        move_sessions(&host->workers[i], &host->workers[i % runners]);
+    pthread_mutex_unlock(&host->start_lock);
+
+    if (started == 0)
+        worker_main(&host->workers[0]);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(host->workers[i].thread, NULL);
+
+    return ok;
+}
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "pvm/io.h"
+
+// -----------------------------------------------------------------------------
+// Terminal backend
+// -----------------------------------------------------------------------------
+
+bool vm_term_open(vm_term_t *term, int in_fd, int out_fd)
+{
+    term->in_fd = in_fd;
+    term->out_fd = out_fd;
+    term->eof = false;
+    term->is_tty = tcgetattr(in_fd, &term->saved_tio) == 0;
+
+    if (term->is_tty)
+    {
+        struct termios raw = term->saved_tio;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(in_fd, TCSANOW, &raw);
+    }
+
+    term->saved_flags = fcntl(in_fd, F_GETFL, 0);
+    if (term->saved_flags < 0)
+        return false;
+    return fcntl(in_fd, F_SETFL, term->saved_flags | O_NONBLOCK) == 0;
+}
+
+void vm_term_close(vm_term_t *term)
+{
+    if (term->is_tty)
+        tcsetattr(term->in_fd, TCSANOW, &term->saved_tio);
+    if (term->saved_flags >= 0)
+        fcntl(term->in_fd, F_SETFL, term->saved_flags);
+}
+
+// Block until input is available or the timeout expires (-1 waits forever).
+// Returns false once the input has hit end-of-file.
+bool vm_term_wait(vm_term_t *term, int timeout_ms)
+{
+    if (term->eof)
+        return false;
+
+    struct pollfd pfd = {.fd = term->in_fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+static int term_getc(void *ctx)
+{
+    vm_term_t *term = ctx;
+    unsigned char ch;
+    ssize_t n = read(term->in_fd, &ch, 1);
+    if (n == 0)
+        term->eof = true;
+    return n == 1 ? ch : -1;
+}
+
+static void term_putc(void *ctx, int ch)
+{
+    vm_term_t *term = ctx;
+    unsigned char c = (unsigned char)ch;
+    while (write(term->out_fd, &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+vm_io_t vm_io_terminal(vm_term_t *term)
+{
+    return (vm_io_t){.getc = term_getc, .putc = term_putc, .ctx = term};
+}
+
+// -----------------------------------------------------------------------------
+// Memory backend
+// -----------------------------------------------------------------------------
+
+void vm_membuf_init(vm_membuf_t *buf, const uint8_t *in, size_t in_len)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->in = in;
+    buf->in_len = in_len;
+}
+
+void vm_membuf_free(vm_membuf_t *buf)
+{
+    free(buf->out);
+    buf->out = NULL;
+    buf->out_len = buf->out_cap = 0;
+}
+
+static int mem_getc(void *ctx)
+{
+    vm_membuf_t *buf = ctx;
+    if (buf->in_pos >= buf->in_len)
+        return -1;
+    return buf->in[buf->in_pos++];
+}
+
+static void mem_putc(void *ctx, int ch)
+{
+    vm_membuf_t *buf = ctx;
+    if (buf->out_max && buf->out_len >= buf->out_max)
+    {
+        buf->truncated = true;
+        return;
+    }
+    if (buf->out_len == buf->out_cap)
+    {
+        size_t cap = buf->out_cap ? buf->out_cap * 2 : 256;
+        uint8_t *out = realloc(buf->out, cap);
+        if (!out)
+            return;
+        buf->out = out;
+        buf->out_cap = cap;
+    }
+    buf->out[buf->out_len++] = (uint8_t)ch;
+}
+
+vm_io_t vm_io_memory(vm_membuf_t *buf)
+{
+    return (vm_io_t){.getc = mem_getc, .putc = mem_putc, .ctx = buf};
+}
+
+// -----------------------------------------------------------------------------
+// Record / replay
+// -----------------------------------------------------------------------------
+
+#define INPUT_LOG_HEADER "pvm-input 1\n"
+
+#define DIGEST_SEED 0xCBF29CE484222325ULL
+
+// FNV-1a over the guest's output, so the end line stays one short record.
+static uint64_t digest_byte(uint64_t digest, int ch)
+{
+    return (digest ^ (uint8_t)ch) * 0x100000001B3ULL;
+}
+
+bool vm_record_open(vm_record_t *rec, const char *path, vm_io_t inner, const uint64_t *clock)
+{
+    rec->inner = inner;
+    rec->clock = clock;
+    rec->out_len = 0;
+    rec->out_digest = DIGEST_SEED;
+    rec->log = fopen(path, "w");
+    if (!rec->log)
+    {
+        perror(path);
+        return false;
+    }
+    fputs(INPUT_LOG_HEADER, rec->log);
+    return true;
+}
+
+void vm_record_close(vm_record_t *rec)
+{
+    if (rec->log)
+    {
+        fprintf(rec->log, "end %llu %llu %016llx\n", (unsigned long long)*rec->clock,
+                (unsigned long long)rec->out_len, (unsigned long long)rec->out_digest);
+        fclose(rec->log);
+    }
+    rec->log = NULL;
+}
+
+static int record_getc(void *ctx)
+{
+    vm_record_t *rec = ctx;
+    int ch = rec->inner.getc ? rec->inner.getc(rec->inner.ctx) : -1;
+    if (ch >= 0)
+    {
+        // Flushed per event so a crashed run still leaves a usable log.
+        fprintf(rec->log, "%llu %d\n", (unsigned long long)*rec->clock, ch);
+        fflush(rec->log);
+    }
+    return ch;
+}
+
+static void record_putc(void *ctx, int ch)
+{
+    vm_record_t *rec = ctx;
+    rec->out_len++;
+    rec->out_digest = digest_byte(rec->out_digest, ch);
+    if (rec->inner.putc)
+        rec->inner.putc(rec->inner.ctx, ch);
+}
+
+vm_io_t vm_io_record(vm_record_t *rec)
+{
+    return (vm_io_t){.getc = record_getc, .putc = record_putc, .ctx = rec};
+}
+
+static void replay_advance(vm_replay_t *rep)
+{
+    unsigned long long at;
+    int ch;
+
+    unsigned long long len, digest;
+
+    if (rep->log && fscanf(rep->log, "%llu %d", &at, &ch) == 2)
+    {
+        rep->next_at = at;
+        rep->next_ch = ch & 0xFF;
+        return;
+    }
+
+    rep->next_ch = -1;
+    if (rep->log && fscanf(rep->log, " end %llu %llu %llx", &at, &len, &digest) == 3)
+    {
+        rep->has_end = true;
+        rep->end_at = at;
+        rep->end_len = len;
+        rep->end_digest = digest;
+    }
+}
+
+bool vm_replay_open(vm_replay_t *rep, const char *path, vm_io_t output, const uint64_t *clock)
+{
+    char header[32];
+
+    rep->output = output;
+    rep->clock = clock;
+    rep->out_len = 0;
+    rep->out_digest = DIGEST_SEED;
+    rep->has_end = false;
+    rep->log = fopen(path, "r");
+    if (!rep->log)
+    {
+        perror(path);
+        return false;
+    }
+
+    if (!fgets(header, sizeof(header), rep->log) || strcmp(header, INPUT_LOG_HEADER) != 0)
+    {
+        fprintf(stderr, "Error: %s is not an input log\n", path);
+        vm_replay_close(rep);
+        return false;
+    }
+
+    replay_advance(rep);
+    return true;
+}
+
+void vm_replay_close(vm_replay_t *rep)
+{
+    if (rep->log)
+        fclose(rep->log);
+    rep->log = NULL;
+    rep->next_ch = -1;
+}
+
+bool vm_replay_finished(const vm_replay_t *rep)
+{
+    return rep->next_ch < 0;
+}
+
+/*
+ * vm_replay_check:
+ *   Compares the replay so far with the recording's end line: retired
+ *   instructions, output length and output digest. Prints each mismatch
+ *   to out. A log without an end line (the recorder crashed) has nothing
+ *   to compare against and passes.
+ */
+bool vm_replay_check(const vm_replay_t *rep, FILE *out)
+{
+    if (!rep->has_end)
+        return true;
+
+    bool ok = true;
+    if (*rep->clock != rep->end_at)
+    {
+        fprintf(out, "replay: retired %llu instructions, recording retired %llu\n",
+                (unsigned long long)*rep->clock, (unsigned long long)rep->end_at);
+        ok = false;
+    }
+    if (rep->out_len != rep->end_len || rep->out_digest != rep->end_digest)
+    {
+        fprintf(out, "replay: output differs (%llu bytes, recording had %llu)\n", (unsigned long long)rep->out_len,
+                (unsigned long long)rep->end_len);
+        ok = false;
+    }
+    return ok;
+}
+
+static int replay_getc(void *ctx)
+{
+    vm_replay_t *rep = ctx;
+    if (rep->next_ch < 0 || *rep->clock < rep->next_at)
+        return -1;
+
+    // The recording saw this key at exactly this instruction; arriving
+    // late means the replay has diverged, so say so but keep going.
+    if (*rep->clock > rep->next_at)
+        fprintf(stderr, "Warning: replay diverged, input for %llu delivered at %llu\n",
+                (unsigned long long)rep->next_at, (unsigned long long)*rep->clock);
+
+    int ch = rep->next_ch;
+    replay_advance(rep);
+    return ch;
+}
+
+static void replay_putc(void *ctx, int ch)
+{
+    vm_replay_t *rep = ctx;
+    rep->out_len++;
+    rep->out_digest = digest_byte(rep->out_digest, ch);
+    if (rep->output.putc)
+        rep->output.putc(rep->output.ctx, ch);
+}
+
+vm_io_t vm_io_replay(vm_replay_t *rep)
+{
+    return (vm_io_t){.getc = replay_getc, .putc = replay_putc, .ctx = rep};
+}
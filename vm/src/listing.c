@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/listing.h"
+#include "pvm/assembler.h"
+#include "pvm/debugmap.h"
+#include "pvm/mmio.h"
+#include "pvm/symbol.h"
+
+#define KIND_NONE 0
+#define KIND_CODE 1
+#define KIND_DATA 2
+
+static const char *const op_names[VM_COST_OPCODES] = {"BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+                                                       "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"};
+
+// -----------------------------------------------------------------------------
+// Cost model
+// -----------------------------------------------------------------------------
+
+void vm_cost_model_default(vm_cost_model_t *model)
+{
+    static const uint16_t defaults[VM_COST_OPCODES] = {1, 1, 2, 2, 2, 1, 2, 2, 4, 1, 3, 3, 2, 1, 1, 4};
+    memcpy(model->op, defaults, sizeof(defaults));
+}
+
+/*
+ * vm_cost_model_load:
+ *   Reads "MNEMONIC cost" lines (base opcode names: BR, ADD, ..., TRAP)
+ *   over the defaults. Blank lines and lines starting with '#' are
+ *   skipped.
+ */
+bool vm_cost_model_load(vm_cost_model_t *model, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    vm_cost_model_default(model);
+
+    char buf[128];
+    int line = 0;
+    bool ok = true;
+    while (ok && fgets(buf, sizeof(buf), f))
+    {
+        char name[16];
+        unsigned cost;
+        line++;
+
+        if (buf[0] == '#' || buf[strspn(buf, " \t\r\n")] == '\0')
+            continue;
+
+        ok = false;
+        if (sscanf(buf, "%15s %u", name, &cost) == 2 && cost <= 0xFFFF)
+        {
+            for (int op = 0; op < VM_COST_OPCODES; op++)
+            {
+                if (strcmp(name, op_names[op]) == 0)
+                {
+                    model->op[op] = (uint16_t)cost;
+                    ok = true;
+                }
+            }
+        }
+        if (!ok)
+            fprintf(stderr, "Error: %s:%d: expected \"<opcode> <cost>\"\n", path, line);
+    }
+
+    fclose(f);
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+// Program image
+// -----------------------------------------------------------------------------
+
+typedef struct
+{
+    const vm_cost_model_t *model;
+    debug_map_t *map;
+    uint16_t *image;  // assembled words by address
+    uint8_t *kind;    // KIND_* by address
+    bool *leader;     // code address that starts a basic block
+    char **source;    // source text by line number - 1
+    size_t source_count;
+} listing_t;
+
+static uint16_t sign_extend(uint16_t x, int bits)
+{
+    if ((x >> (bits - 1)) & 1)
+        x |= (uint16_t)(0xFFFF << bits);
+    return x;
+}
+
+static bool is_transfer(uint16_t word)
+{
+    uint16_t op = word >> 12;
+    return op == OP_BR || op == OP_JMP || op == OP_JSR || op == OP_TRAP || op == OP_RTI;
+}
+
+// PC-relative BR or JSR target.
+static bool static_target(uint16_t address, uint16_t word, uint16_t *target)
+{
+    uint16_t op = word >> 12;
+    if (op == OP_BR && (word & 0x0E00))
+        *target = (uint16_t)(address + 1 + sign_extend(word & 0x1FF, 9));
+    else if (op == OP_JSR && (word & 0x0800))
+        *target = (uint16_t)(address + 1 + sign_extend(word & 0x7FF, 11));
+    else
+        return false;
+    return true;
+}
+
+static uint16_t cost_of(const listing_t *l, uint16_t address)
+{
+    return l->model->op[l->image[address] >> 12];
+}
+
+// Data accesses the instruction makes; indirect forms make two.
+static int accesses_of(uint16_t word)
+{
+    switch (word >> 12)
+    {
+    case OP_LD:
+    case OP_LDR:
+    case OP_ST:
+    case OP_STR:
+        return 1;
+    case OP_LDI:
+    case OP_STI:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static bool read_source(listing_t *l, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    char buf[512];
+    size_t cap = 0;
+    while (fgets(buf, sizeof(buf), f))
+    {
+        buf[strcspn(buf, "\r\n")] = '\0';
+        if (l->source_count == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            char **source = realloc(l->source, cap * sizeof(char *));
+            if (!source)
+                break;
+            l->source = source;
+        }
+
+        char *copy = malloc(strlen(buf) + 1);
+        if (!copy)
+            break;
+        strcpy(copy, buf);
+        l->source[l->source_count++] = copy;
+    }
+    fclose(f);
+    return true;
+}
+
+static void find_leaders(listing_t *l)
+{
+    for (uint32_t a = 0; a < 0x10000; a++)
+    {
+        if (l->kind[a] != KIND_CODE)
+            continue;
+
+        uint16_t target;
+        if (a == 0 || l->kind[a - 1] != KIND_CODE)
+            l->leader[a] = true;
+        if (static_target((uint16_t)a, l->image[a], &target) && l->kind[target] == KIND_CODE)
+            l->leader[target] = true;
+        if (is_transfer(l->image[a]) && a + 1 < 0x10000)
+            l->leader[a + 1] = true;
+    }
+
+    for (size_t i = 0; i < l->map->label_count; i++)
+    {
+        uint16_t a = l->map->labels[i].address;
+        if (l->kind[a] == KIND_CODE)
+            l->leader[a] = true;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Sections
+// -----------------------------------------------------------------------------
+
+static void print_lines(const listing_t *l, FILE *out)
+{
+    fprintf(out, "%-6s %-6s %5s %5s  %s\n", "addr", "word", "cost", "line", "source");
+    for (size_t i = 0; i < l->map->line_count; i++)
+    {
+        const debug_line_t *line = &l->map->lines[i];
+        uint16_t a = line->address;
+        const char *text = line->line >= 1 && (size_t)line->line <= l->source_count ? l->source[line->line - 1] : "";
+
+        if (l->kind[a] == KIND_CODE)
+            fprintf(out, "x%04X  x%04X  %5u %5d  %s\n", a, l->image[a], cost_of(l, a), line->line, text);
+        else if (line->words == 1)
+            fprintf(out, "x%04X  x%04X  %5s %5d  %s\n", a, l->image[a], "", line->line, text);
+        else
+            fprintf(out, "x%04X  x%04X  %5s %5d  %s  (%u words)\n", a, l->image[a], "", line->line, text,
+                    line->words);
+    }
+}
+
+static void print_blocks(const listing_t *l, FILE *out)
+{
+    fprintf(out, "\n== basic blocks\n");
+    fprintf(out, "  %-13s %6s %6s  %s\n", "range", "instrs", "cost", "where");
+
+    uint32_t a = 0;
+    while (a < 0x10000)
+    {
+        if (l->kind[a] != KIND_CODE)
+        {
+            a++;
+            continue;
+        }
+
+        uint32_t start = a;
+        unsigned cost = 0;
+        do
+        {
+            cost += cost_of(l, (uint16_t)a);
+            a++;
+        } while (a < 0x10000 && l->kind[a] == KIND_CODE && !l->leader[a]);
+
+        char where[96];
+        debug_map_describe(l->map, (uint16_t)start, where, sizeof(where));
+        fprintf(out, "  x%04X-x%04X  %6u %6u  %s\n", start, a - 1, a - start, cost, where);
+    }
+}
+
+// Whether register `reg` holds a device address at `address`: the nearest
+// earlier instruction that sets it, in straight-line code, is an LD of a
+// pointer into the register window (the usual "LD R1, KBSR_PTR" setup).
+static bool holds_device_pointer(const listing_t *l, uint16_t address, unsigned reg)
+{
+    enum { LOOKBACK = 16 };
+
+    for (unsigned back = 1; back <= LOOKBACK && back <= address; back++)
+    {
+        uint16_t at = (uint16_t)(address - back);
+        if (l->kind[at] != KIND_CODE)
+            return false;
+
+        uint16_t word = l->image[at];
+        uint16_t op = word >> 12;
+        if (op == OP_JSR || op == OP_TRAP || op == OP_JMP || op == OP_RTI)
+            return false; // the callee or jump source may set it
+        bool writes = op == OP_ADD || op == OP_AND || op == OP_NOT || op == OP_LD || op == OP_LDI ||
+                      op == OP_LDR || op == OP_LEA;
+        if (!writes || ((word >> 9) & 0x7) != reg)
+            continue;
+        return op == OP_LD && l->image[(uint16_t)(at + 1 + sign_extend(word & 0x1FF, 9))] >= MMIO_BASE;
+    }
+    return false;
+}
+
+static bool loads_from_device(const listing_t *l, uint16_t address)
+{
+    uint16_t word = l->image[address];
+    switch (word >> 12)
+    {
+    case OP_LDI:
+        return l->image[(uint16_t)(address + 1 + sign_extend(word & 0x1FF, 9))] >= MMIO_BASE;
+    case OP_LDR:
+        return holds_device_pointer(l, address, (word >> 6) & 0x7);
+    default:
+        return false;
+    }
+}
+
+/*
+ * print_loops:
+ *   A backward BR closes a loop over [target, branch]. One pass is costed
+ *   as every instruction in the range, an upper bound when the body
+ *   branches internally.
+ */
+static void print_loops(const listing_t *l, FILE *out)
+{
+    fprintf(out, "\n== loops\n");
+    fprintf(out, "  %-13s %6s %6s  %s\n", "range", "instrs", "cost", "header");
+
+    for (uint32_t a = 0; a < 0x10000; a++)
+    {
+        uint16_t target;
+        if (l->kind[a] != KIND_CODE || (l->image[a] >> 12) != OP_BR ||
+            !static_target((uint16_t)a, l->image[a], &target) || target > a || l->kind[target] != KIND_CODE)
+            continue;
+
+        unsigned cost = 0, instrs = 0;
+        bool polls = false, only_branches = true;
+        for (uint32_t b = target; b <= a; b++)
+        {
+            if (l->kind[b] != KIND_CODE)
+                continue;
+            uint16_t word = l->image[b];
+            cost += cost_of(l, (uint16_t)b);
+            instrs++;
+            if ((word >> 12) != OP_BR)
+                only_branches = false;
+            if (loads_from_device(l, (uint16_t)b))
+                polls = true;
+        }
+
+        char where[96];
+        debug_map_describe(l->map, target, where, sizeof(where));
+        fprintf(out, "  x%04X-x%04X  %6u %6u  %s%s\n", target, a, instrs, cost, where,
+                polls ? "  [polls a device]" : only_branches ? "  [spins without reloading flags]" : "");
+    }
+}
+
+static void print_labels(const listing_t *l, FILE *out)
+{
+    fprintf(out, "\n== labels\n");
+    fprintf(out, "  %-16s %6s %6s %6s %6s\n", "label", "addr", "instrs", "mem", "cost");
+
+    for (size_t i = 0; i < l->map->label_count; i++)
+    {
+        const debug_label_t *label = &l->map->labels[i];
+        uint32_t end = i + 1 < l->map->label_count ? l->map->labels[i + 1].address : 0x10000;
+        unsigned instrs = 0, mem = 0, cost = 0;
+
+        for (uint32_t a = label->address; a < end && l->kind[a] != KIND_NONE; a++)
+        {
+            if (l->kind[a] != KIND_CODE)
+                continue;
+            instrs++;
+            mem += (unsigned)accesses_of(l->image[a]);
+            cost += cost_of(l, (uint16_t)a);
+        }
+        if (instrs)
+            fprintf(out, "  %-16s  x%04X %6u %6u %6u\n", label->name, label->address, instrs, mem, cost);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Driver
+// -----------------------------------------------------------------------------
+
+// Assembles the open source and classifies every address it filled as
+// code or data.
+static bool build(listing_t *l, FILE *f, const char *path, token_line_t *tokens, segment_t **segments)
+{
+    size_t line_count = 0;
+    tokenize_file(f, tokens, &line_count);
+    debug_map_add_file(l->map, path);
+    *segments = assemble_debug(tokens, l->map, 0);
+    if (!*segments)
+        return false;
+    load_segments_to_memory(*segments, l->image);
+
+    // Each source line holds at most one instruction or directive.
+    bool *code_line = calloc(l->source_count + 2, sizeof(bool));
+    if (!code_line)
+        return false;
+    for (int i = 0; i < tokens->line_count; i++)
+    {
+        instruction_spec_t spec = find_spec(tokens->instr[i].opcode.value);
+        int line = tokens->instr[i].line_number;
+        if (spec.encode_fn && !spec.is_pseudo && line >= 0 && (size_t)line <= l->source_count + 1)
+            code_line[line] = true;
+    }
+    for (size_t i = 0; i < l->map->line_count; i++)
+    {
+        const debug_line_t *line = &l->map->lines[i];
+        bool code = (size_t)line->line <= l->source_count + 1 && code_line[line->line];
+        for (uint32_t a = line->address; a < (uint32_t)line->address + line->words && a < 0x10000; a++)
+            l->kind[a] = code ? KIND_CODE : KIND_DATA;
+    }
+    free(code_line);
+
+    find_leaders(l);
+    return true;
+}
+
+bool assemble_listing(const char *path, const vm_cost_model_t *model, FILE *out)
+{
+    listing_t l = {.model = model};
+    token_line_t *tokens = calloc(1, sizeof(token_line_t));
+    l.map = debug_map_create();
+    l.image = calloc(0x10000, sizeof(uint16_t));
+    l.kind = calloc(0x10000, 1);
+    l.leader = calloc(0x10000, sizeof(bool));
+    segment_t *segments = NULL;
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        perror(path);
+
+    bool ok = f && tokens && l.map && l.image && l.kind && l.leader && read_source(&l, path) &&
+              build(&l, f, path, tokens, &segments);
+    if (ok)
+    {
+        print_lines(&l, out);
+        print_blocks(&l, out);
+        print_loops(&l, out);
+        print_labels(&l, out);
+    }
+
+    if (f)
+        fclose(f);
+    if (tokens)
+    {
+        for (size_t i = 0; i < tokens->symbol_count; i++)
+            free(tokens->symbols[i]);
+    }
+    free(tokens);
+    free_segments(segments);
+    debug_map_free(l.map);
+    free(l.image);
+    free(l.kind);
+    free(l.leader);
+    for (size_t i = 0; i < l.source_count; i++)
+        free(l.source[i]);
+    free(l.source);
+    return ok;
+}
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/lockstep.h"
+#include "pvm/debugmap.h"
+#include "pvm/statehash.h"
+
+// -----------------------------------------------------------------------------
+// Engines
+// -----------------------------------------------------------------------------
+
+static vm_stop_reason run_reference(void *ctx, VM *vm, uint64_t max_instructions)
+{
+    (void)ctx;
+    return vm_run_for(vm, max_instructions);
+}
+
+// Exercises the slice entry and exit paths on every instruction.
+static vm_stop_reason run_stepped(void *ctx, VM *vm, uint64_t max_instructions)
+{
+    (void)ctx;
+    for (uint64_t i = 0; i < max_instructions; i++)
+    {
+        vm_stop_reason reason = vm_run_for(vm, 1);
+        if (reason != VM_STOP_BUDGET)
+            return reason;
+    }
+    return VM_STOP_BUDGET;
+}
+
+const vm_engine_t vm_engine_reference = {"ref", run_reference, NULL};
+const vm_engine_t vm_engine_stepped = {"step", run_stepped, NULL};
+
+const vm_engine_t *vm_engine_find(const char *name)
+{
+    static const vm_engine_t *const engines[] = {&vm_engine_reference, &vm_engine_stepped};
+
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    {
+        if (strcmp(engines[i]->name, name) == 0)
+            return engines[i];
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Checker
+// -----------------------------------------------------------------------------
+
+vm_lockstep_t *vm_lockstep_create(vm_snapshot_t *boot, const vm_engine_t *a, const vm_engine_t *b)
+{
+    vm_lockstep_t *ls = calloc(1, sizeof(vm_lockstep_t));
+    if (!ls)
+        return NULL;
+
+    vm_snapshot_retain(boot);
+    ls->boot = boot;
+    ls->engine[0] = *a;
+    ls->engine[1] = *b;
+
+    for (int i = 0; i < 2; i++)
+    {
+        ls->vm[i] = vm_fork(boot);
+        if (!ls->vm[i])
+        {
+            vm_lockstep_destroy(ls);
+            return NULL;
+        }
+        vm_hash_enable(ls->vm[i]);
+        vm_membuf_init(&ls->io[i], NULL, 0);
+        vm_set_io(ls->vm[i], vm_io_memory(&ls->io[i]));
+    }
+    return ls;
+}
+
+void vm_lockstep_destroy(vm_lockstep_t *ls)
+{
+    if (!ls)
+        return;
+
+    for (int i = 0; i < 2; i++)
+    {
+        vm_destroy(ls->vm[i]);
+        vm_membuf_free(&ls->io[i]);
+    }
+    vm_snapshot_release(ls->boot);
+    free(ls);
+}
+
+static void reset_sides(vm_lockstep_t *ls)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        vm_restore(ls->vm[i], ls->boot);
+        ls->io[i].in = ls->input;
+        ls->io[i].in_len = ls->input_len;
+        ls->io[i].in_pos = 0;
+        ls->io[i].out_len = 0;
+    }
+}
+
+static bool sides_match(const vm_lockstep_t *ls, const vm_stop_reason reason[2])
+{
+    const VM *a = ls->vm[0], *b = ls->vm[1];
+    const vm_membuf_t *x = &ls->io[0], *y = &ls->io[1];
+
+    return memcmp(a->reg, b->reg, sizeof(a->reg)) == 0 &&
+           memcmp(&a->counters, &b->counters, sizeof(a->counters)) == 0 && a->halted == b->halted &&
+           reason[0] == reason[1] && a->mem_hash == b->mem_hash && x->in_pos == y->in_pos &&
+           x->out_len == y->out_len && (x->out_len == 0 || memcmp(x->out, y->out, x->out_len) == 0);
+}
+
+// Records both sides' state as it stands, with the first differing word of
+// memory. The memory scan only runs once a divergence is known.
+static void capture(vm_lockstep_t *ls, const vm_stop_reason reason[2])
+{
+    vm_divergence_t *d = &ls->divergence;
+
+    for (int i = 0; i < 2; i++)
+    {
+        memcpy(d->reg[i], ls->vm[i]->reg, sizeof(d->reg[i]));
+        d->retired[i] = ls->vm[i]->counters.instructions;
+        d->halted[i] = ls->vm[i]->halted;
+        d->reason[i] = reason[i];
+        d->out_len[i] = ls->io[i].out_len;
+    }
+
+    d->memory = false;
+    if (ls->vm[0]->mem_hash == ls->vm[1]->mem_hash)
+        return;
+
+    for (uint32_t a = 0; a < 0x10000; a++)
+    {
+        uint16_t x = vm_peek(ls->vm[0], (uint16_t)a);
+        uint16_t y = vm_peek(ls->vm[1], (uint16_t)a);
+        if (x != y)
+        {
+            d->memory = true;
+            d->address = (uint16_t)a;
+            d->value[0] = x;
+            d->value[1] = y;
+            return;
+        }
+    }
+}
+
+/*
+ * locate:
+ *   Replays both sides to `good` retired instructions in the same chunks
+ *   as the original run, then single-steps until their states differ.
+ *   Leaves the interval-level capture alone if stepping never does.
+ */
+static void locate(vm_lockstep_t *ls, uint64_t good)
+{
+    reset_sides(ls);
+    uint64_t start = ls->vm[0]->counters.instructions;
+
+    for (uint64_t done = 0; done < good; done += ls->interval)
+    {
+        uint64_t n = good - done < ls->interval ? good - done : ls->interval;
+        for (int i = 0; i < 2; i++)
+            ls->engine[i].run(ls->engine[i].ctx, ls->vm[i], n);
+    }
+
+    for (uint64_t step = 0; step < ls->interval; step++)
+    {
+        uint16_t pc[2], instr[2];
+        vm_stop_reason reason[2];
+        for (int i = 0; i < 2; i++)
+        {
+            pc[i] = ls->vm[i]->reg[R_PC];
+            instr[i] = vm_peek(ls->vm[i], pc[i]);
+            reason[i] = ls->engine[i].run(ls->engine[i].ctx, ls->vm[i], 1);
+        }
+
+        if (!sides_match(ls, reason))
+        {
+            capture(ls, reason);
+            ls->divergence.exact = true;
+            ls->divergence.instruction = start + good + step;
+            memcpy(ls->divergence.pc, pc, sizeof(pc));
+            memcpy(ls->divergence.instr, instr, sizeof(instr));
+            return;
+        }
+        if (reason[0] != VM_STOP_BUDGET)
+            return;
+    }
+}
+
+bool vm_lockstep_run(vm_lockstep_t *ls, const uint8_t *input, size_t len, uint64_t interval, uint64_t budget)
+{
+    ls->input = input;
+    ls->input_len = len;
+    ls->interval = interval ? interval : 1;
+    ls->checks = 0;
+    memset(&ls->divergence, 0, sizeof(ls->divergence));
+    if (budget == 0)
+        budget = UINT64_MAX;
+
+    reset_sides(ls);
+    uint64_t start = ls->vm[0]->counters.instructions;
+    uint64_t done = 0;
+
+    while (done < budget)
+    {
+        uint64_t n = budget - done < ls->interval ? budget - done : ls->interval;
+        vm_stop_reason reason[2];
+        for (int i = 0; i < 2; i++)
+            reason[i] = ls->engine[i].run(ls->engine[i].ctx, ls->vm[i], n);
+        ls->checks++;
+
+        if (!sides_match(ls, reason))
+        {
+            capture(ls, reason);
+            ls->divergence.instruction = start + done;
+            locate(ls, done);
+            return false;
+        }
+        if (reason[0] != VM_STOP_BUDGET)
+            break;
+        done = ls->vm[0]->counters.instructions - start;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Report
+// -----------------------------------------------------------------------------
+
+// " LABEL+off (file:line)" when a map is given, otherwise nothing.
+static void describe(const debug_map_t *map, uint16_t address, char *buf, size_t len)
+{
+    buf[0] = '\0';
+    if (map && len > 1)
+    {
+        buf[0] = ' ';
+        debug_map_describe(map, address, buf + 1, len - 1);
+    }
+}
+
+void vm_lockstep_report(const vm_lockstep_t *ls, const debug_map_t *map, FILE *out)
+{
+    static const char *const reg_names[R_COUNT] = {"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND"};
+    const vm_divergence_t *d = &ls->divergence;
+    const char *a = ls->engine[0].name, *b = ls->engine[1].name;
+    char where[96];
+
+    if (d->exact)
+    {
+        describe(map, d->pc[0], where, sizeof(where));
+        fprintf(out, "lockstep: %s and %s diverged at instruction %llu: x%04X%s, word x%04X\n", a, b,
+                (unsigned long long)d->instruction, d->pc[0], where, d->instr[0]);
+        if (d->pc[1] != d->pc[0] || d->instr[1] != d->instr[0])
+        {
+            describe(map, d->pc[1], where, sizeof(where));
+            fprintf(out, "  %s executed x%04X%s, word x%04X\n", b, d->pc[1], where, d->instr[1]);
+        }
+    }
+    else
+    {
+        fprintf(out, "lockstep: %s and %s diverged between instructions %llu and %llu "
+                     "(not reproduced one instruction at a time)\n",
+                a, b, (unsigned long long)d->instruction, (unsigned long long)(d->instruction + ls->interval));
+    }
+
+    fprintf(out, "  %-10s %10s %10s\n", "", a, b);
+    for (int r = 0; r < R_COUNT; r++)
+    {
+        fprintf(out, "  %-10s      x%04X      x%04X%s\n", reg_names[r], d->reg[0][r], d->reg[1][r],
+                d->reg[0][r] != d->reg[1][r] ? "  <--" : "");
+    }
+    if (d->retired[0] != d->retired[1])
+        fprintf(out, "  %-10s %10llu %10llu  <--\n", "retired", (unsigned long long)d->retired[0],
+                (unsigned long long)d->retired[1]);
+    if (d->halted[0] != d->halted[1] || d->reason[0] != d->reason[1])
+        fprintf(out, "  %-10s %10s %10s  <--\n", "stop", vm_stop_reason_name(d->reason[0]),
+                vm_stop_reason_name(d->reason[1]));
+    if (d->out_len[0] != d->out_len[1])
+        fprintf(out, "  %-10s %10zu %10zu  <--\n", "output", d->out_len[0], d->out_len[1]);
+    if (d->memory)
+    {
+        describe(map, d->address, where, sizeof(where));
+        fprintf(out, "  mem x%04X      x%04X      x%04X  <--%s\n", d->address, d->value[0], d->value[1], where);
+    }
+}
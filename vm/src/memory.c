@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "pvm/memory.h"
+#include "pvm/mmio.h"
+#include "pvm/statehash.h"
+
+#define PAGE_OF(addr) ((uint8_t)((addr) >> VM_PAGE_SHIFT))
+#define OFFSET_OF(addr) ((addr) & (VM_PAGE_WORDS - 1))
+#define PAGE_BYTES (VM_PAGE_WORDS * sizeof(uint16_t))
+
+// Never stored to: PAGE_SHARED sends the first write through
+// copy-on-write like any other borrowed page, and freeing skips shared
+// pages.
+const uint16_t vm_zero_page[VM_PAGE_WORDS];
+
+// Attribute bits that describe the address itself rather than who owns the
+// page backing it; these survive a restore.
+static uint8_t fixed_attr(VM *vm, size_t page)
+{
+    return vm->page_attr[page] & ~(PAGE_SHARED | PAGE_CLEAN | PAGE_PACKED);
+}
+
+static void mark_dirty(VM *vm, uint8_t page)
+{
+    vm->dirty[page / 64] |= 1ULL << (page % 64);
+}
+
+static void mark_fixed_pages(VM *vm)
+{
+    for (size_t p = PAGE_OF(MMIO_BASE); p < VM_PAGE_COUNT; p++)
+        vm->page_attr[p] |= PAGE_MMIO;
+    vm->page_attr[PAGE_OF(VM_NATIVE_OUT)] |= PAGE_BREAK;
+}
+
+// Frees the pages this VM owns and drops its reference on the base
+// snapshot. The page table is left empty.
+static void drop_pages(VM *vm)
+{
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        if (!(vm->page_attr[p] & PAGE_SHARED))
+            free(vm->pages[p]);
+        vm->pages[p] = NULL;
+    }
+    vm_snapshot_release(vm->base);
+    vm->base = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// VM memory
+// -----------------------------------------------------------------------------
+
+bool vm_init(VM *vm)
+{
+    memset(vm, 0, sizeof(*vm));
+    mark_fixed_pages(vm);
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        vm->pages[p] = calloc(VM_PAGE_WORDS, sizeof(uint16_t));
+        if (!vm->pages[p])
+        {
+            fprintf(stderr, "Error: out of memory allocating guest pages\n");
+            vm_release(vm);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sparse VMs start with every page mapped to the zero page, so an idle VM
+// costs little more than its page table.
+void vm_init_sparse(VM *vm)
+{
+    memset(vm, 0, sizeof(*vm));
+    mark_fixed_pages(vm);
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        vm->pages[p] = (uint16_t *)vm_zero_page;
+        vm->page_attr[p] |= PAGE_SHARED;
+    }
+}
+
+void vm_release(VM *vm)
+{
+    drop_pages(vm);
+}
+
+// Called before the first write to a shared, clean or packed page. Shared
+// pages get a private copy (the only place a fork pays for memory); shared
+// and clean pages are then recorded as dirty so vm_reset knows to restore
+// them.
+bool vm_page_make_writable(VM *vm, uint8_t page)
+{
+    if (!vm_page_unpack(vm, page))
+        return false;
+
+    if (vm->page_attr[page] & PAGE_SHARED)
+    {
+        uint16_t *copy = malloc(PAGE_BYTES);
+        if (!copy)
+        {
+            fprintf(stderr, "Error: out of memory copying guest page 0x%02X\n", page);
+            return false;
+        }
+        memcpy(copy, vm->pages[page], PAGE_BYTES);
+        vm->pages[page] = copy;
+    }
+    else if (!(vm->page_attr[page] & PAGE_CLEAN))
+    {
+        return true;
+    }
+
+    vm->page_attr[page] &= ~(PAGE_SHARED | PAGE_CLEAN);
+    mark_dirty(vm, page);
+    return true;
+}
+
+// Raw accessors: bypass devices and keyboard side effects but honour
+// copy-on-write. Used by loaders, device models and debuggers.
+uint16_t vm_peek(VM *vm, uint16_t address)
+{
+    uint8_t page = PAGE_OF(address);
+    if (!vm_page_unpack(vm, page))
+        return 0;
+    return vm->pages[page][OFFSET_OF(address)];
+}
+
+void vm_poke(VM *vm, uint16_t address, uint16_t value)
+{
+    uint8_t page = PAGE_OF(address);
+    if ((vm->page_attr[page] & (PAGE_SHARED | PAGE_CLEAN | PAGE_PACKED)) && !vm_page_make_writable(vm, page))
+        return;
+
+    uint16_t *word = &vm->pages[page][OFFSET_OF(address)];
+    if (vm->page_attr[page] & PAGE_HASH)
+        vm->mem_hash ^= vm_hash_word(address, *word) ^ vm_hash_word(address, value);
+    *word = value;
+}
+
+// Pages this VM holds a private copy of; shared and zero pages are free.
+size_t vm_resident_pages(const VM *vm)
+{
+    size_t count = 0;
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        if (!(vm->page_attr[p] & PAGE_SHARED))
+            count++;
+    }
+    return count;
+}
+
+void vm_load_segments(VM *vm, segment_t *segments)
+{
+    for (segment_t *seg = segments; seg != NULL; seg = seg->next)
+    {
+        for (size_t i = 0; i < seg->pos; i++)
+            vm_poke(vm, (uint16_t)(seg->origin + i), seg->data[i]);
+    }
+}
+
+// Bulk copies used by DMA-style devices. Ranges must stay below the MMIO
+// window so a transfer can never land on device registers.
+bool vm_mem_read_block(VM *vm, uint16_t address, uint16_t *dst, size_t count)
+{
+    if ((size_t)address + count > MMIO_BASE)
+        return false;
+
+    while (count > 0)
+    {
+        size_t n = VM_PAGE_WORDS - OFFSET_OF(address);
+        if (n > count)
+            n = count;
+        if (!vm_page_unpack(vm, PAGE_OF(address)))
+            return false;
+        memcpy(dst, &vm->pages[PAGE_OF(address)][OFFSET_OF(address)], n * sizeof(uint16_t));
+        dst += n;
+        address += n;
+        count -= n;
+    }
+    return true;
+}
+
+bool vm_mem_write_block(VM *vm, uint16_t address, const uint16_t *src, size_t count)
+{
+    if ((size_t)address + count > MMIO_BASE)
+        return false;
+
+    while (count > 0)
+    {
+        uint8_t page = PAGE_OF(address);
+        size_t n = VM_PAGE_WORDS - OFFSET_OF(address);
+        if (n > count)
+            n = count;
+        if (!vm_page_make_writable(vm, page))
+            return false;
+        if (vm->page_attr[page] & PAGE_WATCH)
+        {
+            // Device DMA is a guest-visible store like any other.
+            for (size_t i = 0; i < n; i++)
+                vm->store_hook.fn(vm->store_hook.ctx, (uint16_t)(address + i), src[i]);
+        }
+        if (vm->page_attr[page] & PAGE_HASH)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                uint16_t at = (uint16_t)(address + i);
+                vm->mem_hash ^= vm_hash_word(at, vm->pages[page][OFFSET_OF(at)]) ^ vm_hash_word(at, src[i]);
+            }
+        }
+        memcpy(&vm->pages[page][OFFSET_OF(address)], src, n * sizeof(uint16_t));
+        src += n;
+        address += n;
+        count -= n;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Snapshots
+// -----------------------------------------------------------------------------
+
+/*
+ * vm_snapshot:
+ *   Freezes the VM's current state. Pages the VM owns move into the
+ *   snapshot, and the VM becomes a fork of it, so taking a snapshot copies
+ *   no memory. The caller owns one reference.
+ */
+vm_snapshot_t *vm_snapshot(VM *vm)
+{
+    // Forks read snapshot pages directly, so they must be plain words.
+    if (!vm_unpack(vm))
+        return NULL;
+
+    vm_snapshot_t *snap = calloc(1, sizeof(vm_snapshot_t));
+    if (!snap)
+    {
+        fprintf(stderr, "Error: out of memory allocating snapshot\n");
+        return NULL;
+    }
+
+    snap->refs = 2; // the caller and vm->base
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        snap->pages[p] = vm->pages[p];
+        if (!(vm->page_attr[p] & PAGE_SHARED))
+            snap->owned[p / 64] |= 1ULL << (p % 64);
+        vm->page_attr[p] = fixed_attr(vm, p) | PAGE_SHARED;
+    }
+    memset(vm->dirty, 0, sizeof(vm->dirty));
+
+    memcpy(snap->reg, vm->reg, sizeof(snap->reg));
+    snap->counters = vm->counters;
+    snap->halted = vm->halted;
+    snap->mem_hash = vm->mem_hash;
+    snap->hash_valid = vm->hashing;
+
+    // The VM's reference on its old base passes to the new snapshot.
+    snap->parent = vm->base;
+    vm->base = snap;
+    return snap;
+}
+
+void vm_snapshot_retain(vm_snapshot_t *snap)
+{
+    __atomic_add_fetch(&snap->refs, 1, __ATOMIC_RELAXED);
+}
+
+void vm_snapshot_release(vm_snapshot_t *snap)
+{
+    // Walk up the chain instead of recursing; a long run of snapshots
+    // should not be able to blow the stack on teardown.
+    while (snap && __atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        vm_snapshot_t *parent = snap->parent;
+        for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+        {
+            if (snap->owned[p / 64] & (1ULL << (p % 64)))
+                free(snap->pages[p]);
+        }
+        if (snap->mapping)
+            munmap(snap->mapping, snap->mapping_len);
+        free(snap);
+        snap = parent;
+    }
+}
+
+static void restore_state(VM *vm, vm_snapshot_t *snap)
+{
+    memcpy(vm->reg, snap->reg, sizeof(vm->reg));
+    vm->counters = snap->counters;
+    vm->halted = snap->halted;
+    vm->stop = VM_STOP_NONE;
+    vm->wait = (vm_wait_t){.kind = VM_WAIT_NONE};
+
+    if (vm->hashing)
+        vm->mem_hash = snap->hash_valid ? snap->mem_hash : vm_hash_memory(vm);
+}
+
+/*
+ * vm_restore:
+ *   Resets an existing VM to the snapshot's state. Devices and the I/O
+ *   backend stay attached. Restoring the snapshot the VM already runs on
+ *   is a vm_reset; otherwise every page is shared until the guest writes it.
+ */
+void vm_restore(VM *vm, vm_snapshot_t *snap)
+{
+    if (vm->base == snap)
+    {
+        vm_reset(vm);
+        return;
+    }
+
+    vm_snapshot_retain(snap);
+    drop_pages(vm);
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        vm->pages[p] = snap->pages[p];
+        vm->page_attr[p] = fixed_attr(vm, p) | PAGE_SHARED;
+    }
+    memset(vm->dirty, 0, sizeof(vm->dirty));
+    vm->base = snap;
+    restore_state(vm, snap);
+}
+
+// Makes the VM's current state its reset point.
+bool vm_checkpoint(VM *vm)
+{
+    vm_snapshot_t *snap = vm_snapshot(vm);
+    if (!snap)
+        return false;
+    vm_snapshot_release(snap); // vm->base keeps it alive
+    return true;
+}
+
+/*
+ * vm_reset:
+ *   Rewinds the VM to its base snapshot, copying back only the pages
+ *   written since. Those pages stay private (marked clean) so the next run
+ *   reuses their buffers instead of going through malloc again.
+ */
+bool vm_reset(VM *vm)
+{
+    vm_snapshot_t *snap = vm->base;
+    if (!snap)
+        return false;
+
+    for (size_t w = 0; w < VM_PAGE_COUNT / 64; w++)
+    {
+        uint64_t bits = vm->dirty[w];
+        while (bits)
+        {
+            size_t p = w * 64 + (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (!vm_page_unpack(vm, (uint8_t)p))
+                return false;
+            memcpy(vm->pages[p], snap->pages[p], PAGE_BYTES);
+            vm->page_attr[p] |= PAGE_CLEAN;
+        }
+        vm->dirty[w] = 0;
+    }
+
+    restore_state(vm, snap);
+    return true;
+}
+
+VM *vm_fork(vm_snapshot_t *snap)
+{
+    VM *vm = calloc(1, sizeof(VM));
+    if (!vm)
+        return NULL;
+
+    mark_fixed_pages(vm);
+    vm_restore(vm, snap);
+    return vm;
+}
+
+// -----------------------------------------------------------------------------
+// Idle compression
+// -----------------------------------------------------------------------------
+
+// Word-RLE: a control word with the top bit set is followed by one value
+// repeated (control & 0x7FFF) times; otherwise it is followed by that many
+// literal words. Guest pages are mostly zeros and small repeated words, so
+// this gets most of what a general-purpose compressor would, at memcpy-like
+// speed.
+#define RLE_RUN 0x8000
+#define RLE_MIN_RUN 3 // a run costs two words
+
+// Returns the encoded length in words, or 0 if it would not beat the raw
+// page by at least half.
+static size_t rle_encode(const uint16_t *src, uint16_t *dst)
+{
+    const size_t limit = VM_PAGE_WORDS / 2;
+    size_t in = 0, out = 0;
+
+    while (in < VM_PAGE_WORDS)
+    {
+        size_t run = 1;
+        while (in + run < VM_PAGE_WORDS && src[in + run] == src[in])
+            run++;
+
+        if (run >= RLE_MIN_RUN)
+        {
+            if (out + 2 > limit)
+                return 0;
+            dst[out++] = (uint16_t)(RLE_RUN | run);
+            dst[out++] = src[in];
+            in += run;
+            continue;
+        }
+
+        size_t start = in;
+        while (in < VM_PAGE_WORDS &&
+               !(in + 2 < VM_PAGE_WORDS && src[in] == src[in + 1] && src[in] == src[in + 2]))
+            in++;
+
+        size_t n = in - start;
+        if (out + 1 + n > limit)
+            return 0;
+        dst[out++] = (uint16_t)n;
+        memcpy(&dst[out], &src[start], n * sizeof(uint16_t));
+        out += n;
+    }
+    return out;
+}
+
+static void rle_decode(const uint16_t *src, uint16_t *dst)
+{
+    size_t out = 0;
+    while (out < VM_PAGE_WORDS)
+    {
+        uint16_t ctl = *src++;
+        size_t n = ctl & ~RLE_RUN;
+
+        if (ctl & RLE_RUN)
+        {
+            for (size_t i = 0; i < n; i++)
+                dst[out++] = *src;
+            src++;
+        }
+        else
+        {
+            memcpy(&dst[out], src, n * sizeof(uint16_t));
+            src += n;
+            out += n;
+        }
+    }
+}
+
+static size_t pack_page(VM *vm, size_t p, uint16_t *scratch)
+{
+    uint8_t attr = vm->page_attr[p];
+    if (attr & (PAGE_SHARED | PAGE_PACKED))
+        return 0;
+
+    // A clean page still equals the base copy, so just share that again.
+    if ((attr & PAGE_CLEAN) && vm->base)
+    {
+        free(vm->pages[p]);
+        vm->pages[p] = vm->base->pages[p];
+        vm->page_attr[p] = fixed_attr(vm, p) | PAGE_SHARED;
+        return PAGE_BYTES;
+    }
+
+    size_t words = rle_encode(vm->pages[p], scratch);
+    if (words == 0)
+        return 0;
+
+    uint16_t *packed = malloc(words * sizeof(uint16_t));
+    if (!packed)
+        return 0;
+    memcpy(packed, scratch, words * sizeof(uint16_t));
+    free(vm->pages[p]);
+    vm->pages[p] = packed;
+    vm->page_attr[p] |= PAGE_PACKED;
+    return PAGE_BYTES - words * sizeof(uint16_t);
+}
+
+/*
+ * vm_pack:
+ *   Compresses the pages an idle VM owns and returns the bytes released.
+ *   Nothing has to be undone before the VM runs again: packed pages take
+ *   the slow path on every access and are unpacked one at a time as the
+ *   guest touches them.
+ */
+size_t vm_pack(VM *vm)
+{
+    uint16_t scratch[VM_PAGE_WORDS / 2];
+    size_t saved = 0;
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+        saved += pack_page(vm, p, scratch);
+    return saved;
+}
+
+bool vm_page_unpack(VM *vm, uint8_t page)
+{
+    if (!(vm->page_attr[page] & PAGE_PACKED))
+        return true;
+
+    uint16_t *words = malloc(PAGE_BYTES);
+    if (!words)
+    {
+        fprintf(stderr, "Error: out of memory unpacking guest page 0x%02X\n", page);
+        return false;
+    }
+    rle_decode(vm->pages[page], words);
+    free(vm->pages[page]);
+    vm->pages[page] = words;
+    vm->page_attr[page] &= ~PAGE_PACKED;
+    return true;
+}
+
+bool vm_unpack(VM *vm)
+{
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        if (!vm_page_unpack(vm, (uint8_t)p))
+            return false;
+    }
+    return true;
+}
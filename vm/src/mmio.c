@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pvm/mmio.h"
+
+static bool overlaps(const mmio_device_t *a, const mmio_device_t *b)
+{
+    return a->base < b->base + b->size && b->base < a->base + a->size;
+}
+
+bool mmio_attach(VM *vm, mmio_device_t *dev)
+{
+    if (dev->base < MMIO_BASE || (uint32_t)dev->base + dev->size > 0x10000)
+    {
+        fprintf(stderr, "Error: device '%s' outside MMIO range (0x%04X)\n", dev->name, dev->base);
+        return false;
+    }
+
+    if (vm->device_count >= MMIO_MAX_DEVICES)
+    {
+        fprintf(stderr, "Error: MMIO bus full, cannot attach '%s'\n", dev->name);
+        return false;
+    }
+
+    for (size_t i = 0; i < vm->device_count; i++)
+    {
+        if (overlaps(vm->devices[i], dev))
+        {
+            fprintf(stderr, "Error: device '%s' overlaps '%s' at 0x%04X\n",
+                    dev->name, vm->devices[i]->name, dev->base);
+            return false;
+        }
+    }
+
+    vm->devices[vm->device_count++] = dev;
+    return true;
+}
+
+void mmio_detach(VM *vm, mmio_device_t *dev)
+{
+    for (size_t i = 0; i < vm->device_count; i++)
+    {
+        if (vm->devices[i] == dev)
+        {
+            vm->devices[i] = vm->devices[--vm->device_count];
+            vm->devices[vm->device_count] = NULL;
+            return;
+        }
+    }
+}
+
+mmio_device_t *mmio_find(VM *vm, uint16_t address)
+{
+    for (size_t i = 0; i < vm->device_count; i++)
+    {
+        mmio_device_t *dev = vm->devices[i];
+        if (address >= dev->base && address < dev->base + dev->size)
+            return dev;
+    }
+    return NULL;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/perfctr.h"
+
+#define PC_REG_CR (PCTR_COUNT * 2)
+#define PC_REG_COUNT (PC_REG_CR + 1)
+
+// Nothing here runs per instruction: the interpreter only bumps
+// vm->counters, and the device derives guest-visible values on read.
+
+static void live_values(VM *vm, uint64_t out[PCTR_COUNT])
+{
+    out[PCTR_INSTRUCTIONS] = vm->counters.instructions;
+    out[PCTR_LOADS] = vm->counters.loads;
+    out[PCTR_STORES] = vm->counters.stores;
+    out[PCTR_BRANCHES] = vm->counters.branches;
+    out[PCTR_TRAPS] = vm->counters.traps;
+}
+
+// vm_restore and vm_reset can wind vm->counters back past the last reset
+// or freeze. The guest's baseline is gone then, so the device behaves as if
+// it had been reset at the restored point instead of wrapping around.
+static void rebase_if_rewound(perfctr_t *pc, const uint64_t live[PCTR_COUNT])
+{
+    for (int i = 0; i < PCTR_COUNT; i++)
+    {
+        if (live[i] < pc->zero[i] || (pc->is_frozen && live[i] < pc->frozen[i]))
+        {
+            memcpy(pc->zero, live, sizeof(pc->zero));
+            memcpy(pc->frozen, live, sizeof(pc->frozen));
+            return;
+        }
+    }
+}
+
+static uint32_t counter_value(perfctr_t *pc, VM *vm, int index)
+{
+    uint64_t live[PCTR_COUNT];
+    live_values(vm, live);
+    rebase_if_rewound(pc, live);
+
+    uint64_t now = pc->is_frozen ? pc->frozen[index] : live[index];
+    return (uint32_t)(now - pc->zero[index]);
+}
+
+static uint16_t perfctr_read(mmio_device_t *dev, VM *vm, uint16_t offset)
+{
+    perfctr_t *pc = dev->ctx;
+
+    if (offset == PC_REG_CR)
+        return pc->is_frozen ? PCCR_FREEZE : 0;
+
+    if (offset & 1)
+        return pc->latched_hi;
+
+    uint32_t value = counter_value(pc, vm, offset / 2);
+    pc->latched_hi = (uint16_t)(value >> 16);
+    return (uint16_t)value;
+}
+
+static void perfctr_write(mmio_device_t *dev, VM *vm, uint16_t offset, uint16_t value)
+{
+    perfctr_t *pc = dev->ctx;
+    uint64_t live[PCTR_COUNT];
+
+    if (offset != PC_REG_CR)
+        return;
+
+    live_values(vm, live);
+    rebase_if_rewound(pc, live);
+
+    if (value & PCCR_RESET)
+    {
+        memcpy(pc->zero, live, sizeof(live));
+        memcpy(pc->frozen, live, sizeof(live));
+    }
+
+    bool freeze = (value & PCCR_FREEZE) != 0;
+    if (freeze && !pc->is_frozen)
+    {
+        memcpy(pc->frozen, live, sizeof(live));
+    }
+    else if (!freeze && pc->is_frozen)
+    {
+        // Skip the events that happened while frozen.
+        for (int i = 0; i < PCTR_COUNT; i++)
+            pc->zero[i] += live[i] - pc->frozen[i];
+    }
+    pc->is_frozen = freeze;
+}
+
+perfctr_t *perfctr_create(void)
+{
+    perfctr_t *pc = calloc(1, sizeof(perfctr_t));
+    if (!pc)
+        return NULL;
+
+    pc->dev = (mmio_device_t){
+        .name = "perfctr",
+        .base = PC_BASE,
+        .size = PC_REG_COUNT,
+        .read = perfctr_read,
+        .write = perfctr_write,
+        .ctx = pc};
+
+    return pc;
+}
+
+void perfctr_destroy(perfctr_t *pc)
+{
+    free(pc);
+}
+
+bool perfctr_attach(VM *vm, perfctr_t *pc, uint16_t base)
+{
+    pc->dev.base = base;
+    return mmio_attach(vm, &pc->dev);
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/profile.h"
+
+#define PROF_DUMP_TOP 16
+
+static const char *const opcode_names[PROF_OPCODES][2] = {
+    {"BR", NULL},          {"ADD reg", "ADD imm"}, {"LD", NULL},   {"ST", NULL},
+    {"JSRR", "JSR"},       {"AND reg", "AND imm"}, {"LDR", NULL},  {"STR", NULL},
+    {"RTI", NULL},         {"NOT", NULL},          {"LDI", NULL},  {"STI", NULL},
+    {"JMP", NULL},         {"RES", NULL},          {"LEA", NULL},  {"TRAP", NULL},
+};
+
+vm_profile_t *vm_profile_create(void)
+{
+    vm_profile_t *prof = calloc(1, sizeof(vm_profile_t));
+    if (!prof)
+        fprintf(stderr, "Error: out of memory allocating profile\n");
+    return prof;
+}
+
+void vm_profile_destroy(vm_profile_t *prof)
+{
+    free(prof);
+}
+
+// Zeroes every counter; the dump setting is kept.
+void vm_profile_reset(vm_profile_t *prof)
+{
+    FILE *dump = prof->dump_at_halt;
+    memset(prof, 0, sizeof(*prof));
+    prof->dump_at_halt = dump;
+}
+
+// -----------------------------------------------------------------------------
+// Dump
+// -----------------------------------------------------------------------------
+
+// Addresses of the n largest non-zero entries of counts, largest first.
+// Insertion into a short sorted list: one pass over the 64K array.
+static size_t top_addresses(const uint64_t *counts, uint16_t *out, size_t n)
+{
+    size_t found = 0;
+
+    for (uint32_t a = 0; a < 0x10000; a++)
+    {
+        uint64_t c = counts[a];
+        if (c == 0 || (found == n && c <= counts[out[n - 1]]))
+            continue;
+
+        size_t i = found < n ? found++ : n - 1;
+        while (i > 0 && counts[out[i - 1]] < c)
+        {
+            out[i] = out[i - 1];
+            i--;
+        }
+        out[i] = (uint16_t)a;
+    }
+    return found;
+}
+
+/*
+ * vm_profile_dump:
+ *   Prints the opcode mix, the hottest PCs and BR sites, and every MMIO
+ *   register the guest touched.
+ */
+void vm_profile_dump(const vm_profile_t *prof, FILE *out)
+{
+    uint64_t total = 0;
+    for (int op = 0; op < PROF_OPCODES; op++)
+        total += prof->opcode[op][0] + prof->opcode[op][1];
+
+    fprintf(out, "== profile: %llu instructions\n", (unsigned long long)total);
+    for (int op = 0; op < PROF_OPCODES; op++)
+    {
+        for (int alt = 0; alt < 2; alt++)
+        {
+            uint64_t c = prof->opcode[op][alt];
+            if (c)
+                fprintf(out, "  %-8s %12llu  %5.1f%%\n", opcode_names[op][alt], (unsigned long long)c,
+                        100.0 * (double)c / (double)total);
+        }
+    }
+
+    uint16_t top[PROF_DUMP_TOP];
+    size_t n = top_addresses(prof->pc, top, PROF_DUMP_TOP);
+    fprintf(out, "== hot PCs\n");
+    for (size_t i = 0; i < n; i++)
+        fprintf(out, "  x%04X %12llu\n", top[i], (unsigned long long)prof->pc[top[i]]);
+
+    // Rank branch sites by how often they were reached.
+    uint64_t *sites = malloc(0x10000 * sizeof(uint64_t));
+    if (sites)
+    {
+        for (uint32_t a = 0; a < 0x10000; a++)
+            sites[a] = prof->br_taken[a] + prof->br_not_taken[a];
+
+        n = top_addresses(sites, top, PROF_DUMP_TOP);
+        fprintf(out, "== branch sites (taken / not taken)\n");
+        for (size_t i = 0; i < n; i++)
+            fprintf(out, "  x%04X %12llu / %llu\n", top[i], (unsigned long long)prof->br_taken[top[i]],
+                    (unsigned long long)prof->br_not_taken[top[i]]);
+        free(sites);
+    }
+
+    fprintf(out, "== MMIO (loads / stores)\n");
+    for (uint32_t r = 0; r < PROF_MMIO_REGS; r++)
+    {
+        if (prof->mmio_loads[r] || prof->mmio_stores[r])
+            fprintf(out, "  x%04X %12llu / %llu\n", MMIO_BASE + r, (unsigned long long)prof->mmio_loads[r],
+                    (unsigned long long)prof->mmio_stores[r]);
+    }
+}
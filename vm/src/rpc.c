@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pvm/rpc.h"
+
+bool rpc_write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool rpc_read_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Payloads are read into a fresh buffer the caller frees; an empty payload
+// yields NULL.
+static bool read_payload(int fd, uint32_t len, uint8_t **out)
+{
+    *out = NULL;
+    if (len == 0)
+        return true;
+    if (len > RPC_MAX_PAYLOAD)
+        return false;
+
+    uint8_t *buf = malloc(len);
+    if (!buf || !rpc_read_all(fd, buf, len))
+    {
+        free(buf);
+        return false;
+    }
+    *out = buf;
+    return true;
+}
+
+bool rpc_send_request(int fd, const rpc_request_t *req, const uint8_t *input)
+{
+    return rpc_write_all(fd, req, sizeof(*req)) &&
+           rpc_write_all(fd, input, req->input_len);
+}
+
+bool rpc_recv_request(int fd, rpc_request_t *req, uint8_t **input)
+{
+    if (!rpc_read_all(fd, req, sizeof(*req)) || req->magic != RPC_MAGIC)
+        return false;
+    return read_payload(fd, req->input_len, input);
+}
+
+bool rpc_send_response(int fd, const rpc_response_t *resp, const uint8_t *output)
+{
+    return rpc_write_all(fd, resp, sizeof(*resp)) &&
+           rpc_write_all(fd, output, resp->output_len);
+}
+
+bool rpc_recv_response(int fd, rpc_response_t *resp, uint8_t **output)
+{
+    if (!rpc_read_all(fd, resp, sizeof(*resp)) || resp->magic != RPC_MAGIC)
+        return false;
+    return read_payload(fd, resp->output_len, output);
+}
+
+static bool fill_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+int rpc_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!fill_address(&addr, path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int rpc_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    if (!fill_address(&addr, path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pvm/sampler.h"
+
+static uint64_t next_gap(vm_sampler_t *s)
+{
+    // xorshift64; quality hardly matters, it only breaks up aliasing
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    return s->period / 2 + s->rng % s->period + 1;
+}
+
+vm_sampler_t *vm_sampler_create(uint64_t period)
+{
+    vm_sampler_t *s = calloc(1, sizeof(vm_sampler_t));
+    if (!s)
+    {
+        fprintf(stderr, "Error: out of memory allocating sampler\n");
+        return NULL;
+    }
+
+    s->period = period ? period : 1000;
+    s->rng = 0x9E3779B97F4A7C15ULL;
+    s->next = next_gap(s);
+    return s;
+}
+
+void vm_sampler_destroy(vm_sampler_t *sampler)
+{
+    free(sampler);
+}
+
+/*
+ * vm_sampler_run:
+ *   Runs like vm_run_for, sampling along the way. A stop part-way through
+ *   a gap keeps the remainder, so resuming after an I/O wait does not
+ *   skew the distribution.
+ */
+vm_stop_reason vm_sampler_run(vm_sampler_t *s, VM *vm, uint64_t max_instructions)
+{
+    while (max_instructions > 0)
+    {
+        uint64_t chunk = s->next < max_instructions ? s->next : max_instructions;
+        uint64_t before = vm->counters.instructions;
+        vm_stop_reason reason = vm_run_for(vm, chunk);
+        uint64_t ran = vm->counters.instructions - before;
+
+        max_instructions -= ran < max_instructions ? ran : max_instructions;
+        s->next -= ran < s->next ? ran : s->next;
+        if (s->next == 0)
+        {
+            s->samples[vm->reg[R_PC]]++;
+            s->total++;
+            s->next = next_gap(s);
+        }
+
+        if (reason != VM_STOP_BUDGET)
+            return reason;
+    }
+    return VM_STOP_BUDGET;
+}
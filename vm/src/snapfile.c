@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pvm/snapfile.h"
+
+#define PAGE_BYTES (VM_PAGE_WORDS * sizeof(uint16_t))
+
+static bool page_is_zero(const uint16_t *page)
+{
+    return page == vm_zero_page || memcmp(page, vm_zero_page, PAGE_BYTES) == 0;
+}
+
+bool vm_snapshot_save(const vm_snapshot_t *snap, const char *path)
+{
+    snapfile_header_t hdr = {
+        .magic = SNAPFILE_MAGIC,
+        .version = SNAPFILE_VERSION,
+        .header_size = SNAPFILE_ALIGN,
+        .page_words = VM_PAGE_WORDS,
+        .halted = snap->halted,
+        .counters = snap->counters};
+    memcpy(hdr.reg, snap->reg, sizeof(hdr.reg));
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        if (!page_is_zero(snap->pages[p]))
+            hdr.present[p / 64] |= 1ULL << (p % 64);
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    static const uint8_t padding[SNAPFILE_ALIGN];
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(padding, SNAPFILE_ALIGN - sizeof(hdr), 1, f) == 1;
+
+    for (size_t p = 0; ok && p < VM_PAGE_COUNT; p++)
+    {
+        if (hdr.present[p / 64] & (1ULL << (p % 64)))
+            ok = fwrite(snap->pages[p], PAGE_BYTES, 1, f) == 1;
+    }
+
+    if (fclose(f) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Error: failed to write snapshot %s\n", path);
+    return ok;
+}
+
+/*
+ * vm_snapshot_load:
+ *   Maps the memory section MAP_PRIVATE and points the snapshot's pages
+ *   straight into it; nothing is parsed or copied. VMs forked from the
+ *   result share the file's page cache until they write.
+ */
+vm_snapshot_t *vm_snapshot_load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    snapfile_header_t hdr;
+    struct stat st;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || fstat(fd, &st) < 0 ||
+        hdr.magic != SNAPFILE_MAGIC)
+    {
+        fprintf(stderr, "Error: %s is not a snapshot file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    if (hdr.version != SNAPFILE_VERSION)
+    {
+        fprintf(stderr, "Error: unsupported snapshot version %u in %s\n", hdr.version, path);
+        close(fd);
+        return NULL;
+    }
+
+    if (hdr.page_words != VM_PAGE_WORDS)
+    {
+        fprintf(stderr, "Error: snapshot %s has %u-word pages, this VM uses %u\n", path, (unsigned)hdr.page_words,
+                (unsigned)VM_PAGE_WORDS);
+        close(fd);
+        return NULL;
+    }
+
+    // The memory section is mapped straight after the header, so it has to
+    // start past the header and on a page boundary.
+    if (hdr.header_size < sizeof(hdr) || hdr.header_size % SNAPFILE_ALIGN != 0)
+    {
+        fprintf(stderr, "Error: snapshot %s has a bad header size %u\n", path, (unsigned)hdr.header_size);
+        close(fd);
+        return NULL;
+    }
+
+    size_t present = 0;
+    for (size_t w = 0; w < VM_PAGE_COUNT / 64; w++)
+        present += (size_t)__builtin_popcountll(hdr.present[w]);
+
+    size_t len = present * PAGE_BYTES;
+    if ((uint64_t)st.st_size < (uint64_t)hdr.header_size + len)
+    {
+        fprintf(stderr, "Error: snapshot %s is truncated\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    vm_snapshot_t *snap = calloc(1, sizeof(vm_snapshot_t));
+    if (!snap)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *data = NULL;
+    if (len > 0)
+    {
+        data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, hdr.header_size);
+        if (data == MAP_FAILED)
+        {
+            perror("Failed to map snapshot");
+            free(snap);
+            close(fd);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    snap->refs = 1;
+    snap->mapping = data;
+    snap->mapping_len = len;
+    memcpy(snap->reg, hdr.reg, sizeof(snap->reg));
+    snap->counters = hdr.counters;
+    snap->halted = hdr.halted != 0;
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        if (hdr.present[p / 64] & (1ULL << (p % 64)))
+        {
+            snap->pages[p] = (uint16_t *)data;
+            data += PAGE_BYTES;
+        }
+        else
+        {
+            snap->pages[p] = (uint16_t *)vm_zero_page;
+        }
+    }
+    return snap;
+}
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/statehash.h"
+#include "pvm/memory.h"
+
+// -----------------------------------------------------------------------------
+// State hash
+// -----------------------------------------------------------------------------
+
+// Full rescan; only needed when hashing is switched on or a VM is restored
+// from a snapshot that was taken without it.
+uint64_t vm_hash_memory(VM *vm)
+{
+    uint64_t hash = 0;
+
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+    {
+        if (vm->pages[p] == vm_zero_page || !vm_page_unpack(vm, (uint8_t)p))
+            continue;
+
+        const uint16_t *page = vm->pages[p];
+        uint16_t base = (uint16_t)(p << VM_PAGE_SHIFT);
+        for (size_t i = 0; i < VM_PAGE_WORDS; i++)
+            hash ^= vm_hash_word((uint16_t)(base + i), page[i]);
+    }
+    return hash;
+}
+
+void vm_hash_enable(VM *vm)
+{
+    if (vm->hashing)
+        return;
+
+    vm->mem_hash = vm_hash_memory(vm);
+    vm->hashing = true;
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+        vm->page_attr[p] |= PAGE_HASH;
+}
+
+void vm_hash_disable(VM *vm)
+{
+    vm->hashing = false;
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+        vm->page_attr[p] &= ~PAGE_HASH;
+}
+
+uint64_t vm_state_hash(const VM *vm)
+{
+    uint64_t hash = vm->mem_hash;
+
+    for (size_t r = 0; r < R_COUNT; r++)
+        hash = vm_hash_word((uint16_t)r, vm->reg[r]) ^ (hash * 0x100000001B3ULL);
+    return hash ^ (vm->halted ? 0x5A5A5A5A5A5A5A5AULL : 0);
+}
+
+// -----------------------------------------------------------------------------
+// Visited set
+// -----------------------------------------------------------------------------
+
+// Hashes are already well mixed, so the low bits index directly. Zero is
+// the empty marker; a real zero hash is stored as 1.
+static uint64_t set_key(uint64_t hash)
+{
+    return hash ? hash : 1;
+}
+
+static bool set_rehash(vm_state_set_t *set, size_t cap)
+{
+    uint64_t *slots = calloc(cap, sizeof(uint64_t));
+    if (!slots)
+    {
+        fprintf(stderr, "Error: out of memory growing visited-state set\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < set->cap; i++)
+    {
+        uint64_t key = set->slots[i];
+        if (!key)
+            continue;
+
+        size_t j = key & (cap - 1);
+        while (slots[j])
+            j = (j + 1) & (cap - 1);
+        slots[j] = key;
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->cap = cap;
+    return true;
+}
+
+bool vm_state_set_init(vm_state_set_t *set, size_t expected)
+{
+    size_t cap = 64;
+    while (cap < expected * 2)
+        cap *= 2;
+
+    memset(set, 0, sizeof(*set));
+    return set_rehash(set, cap);
+}
+
+void vm_state_set_free(vm_state_set_t *set)
+{
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+}
+
+// A failed grow is reported separately from a duplicate, so an explorer
+// that runs out of memory stops instead of pruning unvisited states.
+vm_state_insert_result vm_state_set_insert(vm_state_set_t *set, uint64_t hash)
+{
+    if (vm_state_set_contains(set, hash))
+        return VM_STATE_SEEN;
+
+    // Keep the load factor under 1/2 so probes stay short.
+    if ((set->count + 1) * 2 > set->cap && !set_rehash(set, set->cap * 2))
+        return VM_STATE_NO_MEMORY;
+
+    uint64_t key = set_key(hash);
+    size_t i = key & (set->cap - 1);
+    while (set->slots[i])
+        i = (i + 1) & (set->cap - 1);
+
+    set->slots[i] = key;
+    set->count++;
+    return VM_STATE_NEW;
+}
+
+bool vm_state_set_contains(const vm_state_set_t *set, uint64_t hash)
+{
+    uint64_t key = set_key(hash);
+    size_t i = key & (set->cap - 1);
+    while (set->slots[i])
+    {
+        if (set->slots[i] == key)
+            return true;
+        i = (i + 1) & (set->cap - 1);
+    }
+    return false;
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pvm/stats.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+// Segment
+// -----------------------------------------------------------------------------
+
+/*
+ * vm_stats_create:
+ *   Creates (or replaces) the shared-memory segment `name` ("/pvm" style)
+ *   with the given number of slots, all zero. The segment is unlinked
+ *   again by vm_stats_destroy.
+ */
+vm_stats_t *vm_stats_create(const char *name, size_t slots)
+{
+    if (slots == 0)
+        slots = 1;
+
+    vm_stats_t *stats = calloc(1, sizeof(vm_stats_t));
+    char *copy = malloc(strlen(name) + 1);
+    if (!stats || !copy)
+    {
+        free(stats);
+        free(copy);
+        return NULL;
+    }
+    strcpy(copy, name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    size_t len = sizeof(vm_stats_header_t) + slots * sizeof(vm_stats_slot_t);
+    if (fd < 0 || ftruncate(fd, (off_t)len) < 0)
+    {
+        perror(name);
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        free(stats);
+        free(copy);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror(name);
+        shm_unlink(name);
+        free(stats);
+        free(copy);
+        return NULL;
+    }
+
+    stats->hdr = base;
+    stats->slots = (vm_stats_slot_t *)(stats->hdr + 1);
+    stats->map_len = len;
+    stats->name = copy;
+
+    stats->hdr->version = VM_STATS_VERSION;
+    stats->hdr->slot_count = (uint32_t)slots;
+    stats->hdr->slot_size = sizeof(vm_stats_slot_t);
+    stats->hdr->pid = (uint32_t)getpid();
+    stats->hdr->started_ns = now_ns();
+    __atomic_store_n(&stats->hdr->magic, VM_STATS_MAGIC, __ATOMIC_RELEASE);
+    return stats;
+}
+
+// Maps an existing segment read-only, for monitors.
+vm_stats_t *vm_stats_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        perror(name);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(vm_stats_header_t))
+    {
+        fprintf(stderr, "Error: %s is not a stats segment\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror(name);
+        return NULL;
+    }
+
+    vm_stats_header_t *hdr = base;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != VM_STATS_MAGIC || hdr->version != VM_STATS_VERSION ||
+        hdr->slot_size != sizeof(vm_stats_slot_t) ||
+        sizeof(vm_stats_header_t) + (size_t)hdr->slot_count * sizeof(vm_stats_slot_t) > (size_t)st.st_size)
+    {
+        fprintf(stderr, "Error: %s is not a version %d stats segment\n", name, VM_STATS_VERSION);
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    vm_stats_t *stats = calloc(1, sizeof(vm_stats_t));
+    if (!stats)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    stats->hdr = hdr;
+    stats->slots = (vm_stats_slot_t *)(hdr + 1);
+    stats->map_len = (size_t)st.st_size;
+    return stats;
+}
+
+void vm_stats_destroy(vm_stats_t *stats)
+{
+    if (!stats)
+        return;
+
+    munmap(stats->hdr, stats->map_len);
+    if (stats->name)
+    {
+        shm_unlink(stats->name);
+        free(stats->name);
+    }
+    free(stats);
+}
+
+// -----------------------------------------------------------------------------
+// Writers
+// -----------------------------------------------------------------------------
+
+void vm_stats_publish(vm_stats_t *stats, size_t slot, const uint64_t add[VM_STAT_COUNT])
+{
+    vm_stats_slot_t *s = &stats->slots[slot % stats->hdr->slot_count];
+    uint64_t now = now_ns();
+
+    // Claim the slot: even -> odd.
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        if (seq & 1)
+        {
+            seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (int i = 0; i < VM_STAT_COUNT; i++)
+        __atomic_store_n(&s->value[i], s->value[i] + add[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&s->updated_ns, now, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Publishes what one vm_run_for call did, given the counters from before
+// it.
+void vm_stats_slice(vm_stats_t *stats, size_t slot, const vm_counters_t *before, const VM *vm,
+                    vm_stop_reason reason)
+{
+    uint64_t add[VM_STAT_COUNT] = {
+        [VM_STAT_INSTRUCTIONS] = vm->counters.instructions - before->instructions,
+        [VM_STAT_LOADS] = vm->counters.loads - before->loads,
+        [VM_STAT_STORES] = vm->counters.stores - before->stores,
+        [VM_STAT_BRANCHES] = vm->counters.branches - before->branches,
+        [VM_STAT_TRAPS] = vm->counters.traps - before->traps,
+        [VM_STAT_SLICES] = 1,
+        [VM_STAT_IO_WAITS] = reason == VM_STOP_IO_WAIT,
+        [VM_STAT_HALTS] = reason == VM_STOP_HALT};
+
+    vm_stats_publish(stats, slot, add);
+}
+
+// -----------------------------------------------------------------------------
+// Readers
+// -----------------------------------------------------------------------------
+
+bool vm_stats_read(const vm_stats_t *stats, size_t slot, uint64_t out[VM_STAT_COUNT])
+{
+    if (slot >= stats->hdr->slot_count)
+        return false;
+
+    const vm_stats_slot_t *s = &stats->slots[slot];
+    uint32_t before, after;
+    do
+    {
+        before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < VM_STAT_COUNT; i++)
+            out[i] = __atomic_load_n(&s->value[i], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    return true;
+}
+
+void vm_stats_total(const vm_stats_t *stats, uint64_t out[VM_STAT_COUNT])
+{
+    uint64_t slot[VM_STAT_COUNT];
+
+    memset(out, 0, VM_STAT_COUNT * sizeof(uint64_t));
+    for (size_t i = 0; i < stats->hdr->slot_count; i++)
+    {
+        vm_stats_read(stats, i, slot);
+        for (int j = 0; j < VM_STAT_COUNT; j++)
+            out[j] += slot[j];
+    }
+}
+
+const char *vm_stat_name(vm_stat_index index)
+{
+    static const char *const names[VM_STAT_COUNT] = {
+        "instructions", "loads", "stores", "branches", "traps", "slices", "io-waits", "halts"};
+
+    return index < VM_STAT_COUNT ? names[index] : "unknown";
+}
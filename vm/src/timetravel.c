@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm/timetravel.h"
+#include "pvm/memory.h"
+#include "pvm/mmio.h"
+
+typedef struct
+{
+    uint64_t position;
+    vm_snapshot_t *snap;
+} tt_checkpoint;
+
+typedef struct
+{
+    uint64_t position; // the store happened while retiring this instruction
+    uint16_t address;
+    uint16_t value;
+} tt_write;
+
+typedef struct
+{
+    uint64_t position; // instruction whose KBSR poll picked the key up
+    uint16_t ch;
+} tt_input;
+
+struct vm_tt
+{
+    VM *vm;
+    vm_io_t live; // backend wrapped at creation
+    uint64_t interval;
+    uint64_t horizon; // furthest position reached while recording
+
+    tt_checkpoint *checkpoints;
+    size_t checkpoint_count;
+    size_t checkpoint_cap;
+
+    tt_write *writes;
+    size_t write_count;
+    size_t write_cap;
+
+    tt_input *inputs;
+    size_t input_count;
+    size_t input_cap;
+    size_t input_pos; // next input to hand out while replaying
+};
+
+static uint64_t position(vm_tt_t *tt)
+{
+    return tt->vm->counters.instructions;
+}
+
+// Anything at or before the horizon has already been recorded and is
+// being replayed; past it the VM is live again.
+static bool recording(vm_tt_t *tt)
+{
+    return position(tt) > tt->horizon;
+}
+
+static bool grow(void **buf, size_t *cap, size_t count, size_t size)
+{
+    if (count < *cap)
+        return true;
+
+    size_t new_cap = *cap ? *cap * 2 : 256;
+    void *p = realloc(*buf, new_cap * size);
+    if (!p)
+    {
+        fprintf(stderr, "Error: out of memory growing time-travel log\n");
+        return false;
+    }
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Hooks
+// -----------------------------------------------------------------------------
+
+static void tt_store(void *ctx, uint16_t address, uint16_t value)
+{
+    vm_tt_t *tt = ctx;
+    if (!recording(tt) || !grow((void **)&tt->writes, &tt->write_cap, tt->write_count, sizeof(tt_write)))
+        return;
+    tt->writes[tt->write_count++] = (tt_write){position(tt), address, value};
+}
+
+static int tt_getc(void *ctx)
+{
+    vm_tt_t *tt = ctx;
+    uint64_t now = position(tt);
+
+    if (!recording(tt))
+    {
+        while (tt->input_pos < tt->input_count && tt->inputs[tt->input_pos].position < now)
+            tt->input_pos++;
+        if (tt->input_pos < tt->input_count && tt->inputs[tt->input_pos].position == now)
+            return tt->inputs[tt->input_pos++].ch;
+        return -1;
+    }
+
+    int ch = tt->live.getc ? tt->live.getc(tt->live.ctx) : -1;
+    if (ch >= 0 && grow((void **)&tt->inputs, &tt->input_cap, tt->input_count, sizeof(tt_input)))
+    {
+        tt->inputs[tt->input_count++] = (tt_input){now, (uint16_t)ch};
+        tt->input_pos = tt->input_count;
+    }
+    return ch;
+}
+
+// Replayed output was already written the first time round.
+static void tt_putc(void *ctx, int ch)
+{
+    vm_tt_t *tt = ctx;
+    if (recording(tt) && tt->live.putc)
+        tt->live.putc(tt->live.ctx, ch);
+}
+
+// -----------------------------------------------------------------------------
+// Checkpoints
+// -----------------------------------------------------------------------------
+
+static bool take_checkpoint(vm_tt_t *tt)
+{
+    if (!grow((void **)&tt->checkpoints, &tt->checkpoint_cap, tt->checkpoint_count, sizeof(tt_checkpoint)))
+        return false;
+
+    vm_snapshot_t *snap = vm_snapshot(tt->vm);
+    if (!snap)
+        return false;
+    tt->checkpoints[tt->checkpoint_count++] = (tt_checkpoint){position(tt), snap};
+    return true;
+}
+
+static const tt_checkpoint *latest_checkpoint(vm_tt_t *tt)
+{
+    return &tt->checkpoints[tt->checkpoint_count - 1];
+}
+
+// Last checkpoint at or before pos; the first one is taken at creation, so
+// there always is one for any reachable position.
+static const tt_checkpoint *checkpoint_before(vm_tt_t *tt, uint64_t pos)
+{
+    size_t lo = 0, hi = tt->checkpoint_count;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tt->checkpoints[mid].position <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &tt->checkpoints[lo];
+}
+
+static size_t first_input_after(vm_tt_t *tt, uint64_t pos)
+{
+    size_t lo = 0, hi = tt->input_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tt->inputs[mid].position <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// -----------------------------------------------------------------------------
+// Public API
+// -----------------------------------------------------------------------------
+
+vm_tt_t *vm_tt_create(VM *vm, uint64_t interval)
+{
+    // Device registers are read live and never logged, so a replay through
+    // them would diverge from the recording.
+    if (vm->device_count > 0)
+    {
+        fprintf(stderr, "Error: time travel cannot record a VM with devices attached ('%s')\n",
+                vm->devices[0]->name);
+        return NULL;
+    }
+
+    vm_tt_t *tt = calloc(1, sizeof(vm_tt_t));
+    if (!tt)
+        return NULL;
+
+    tt->vm = vm;
+    tt->live = vm->io;
+    tt->interval = interval ? interval : 1;
+    tt->horizon = vm->counters.instructions;
+
+    if (!take_checkpoint(tt))
+    {
+        free(tt->checkpoints);
+        free(tt);
+        return NULL;
+    }
+
+    vm->io = (vm_io_t){.getc = tt_getc, .putc = tt_putc, .ctx = tt};
+    vm->store_hook = (vm_store_hook_t){.fn = tt_store, .ctx = tt};
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+        vm->page_attr[p] |= PAGE_WATCH;
+    return tt;
+}
+
+// Detaches from the VM, which keeps its current state and original I/O.
+void vm_tt_destroy(vm_tt_t *tt)
+{
+    if (!tt)
+        return;
+
+    VM *vm = tt->vm;
+    for (size_t p = 0; p < VM_PAGE_COUNT; p++)
+        vm->page_attr[p] &= ~PAGE_WATCH;
+    vm->store_hook = (vm_store_hook_t){0};
+    vm->io = tt->live;
+
+    for (size_t i = 0; i < tt->checkpoint_count; i++)
+        vm_snapshot_release(tt->checkpoints[i].snap);
+    free(tt->checkpoints);
+    free(tt->writes);
+    free(tt->inputs);
+    free(tt);
+}
+
+/*
+ * vm_tt_run_for:
+ *   vm_run_for with recording. Slices are cut at checkpoint boundaries;
+ *   after a seek, execution replays from the logs up to the horizon and
+ *   then continues live.
+ */
+vm_stop_reason vm_tt_run_for(vm_tt_t *tt, uint64_t max_instructions)
+{
+    uint64_t now = position(tt);
+    uint64_t end = max_instructions > UINT64_MAX - now ? UINT64_MAX : now + max_instructions;
+    vm_stop_reason reason = VM_STOP_BUDGET;
+
+    while ((now = position(tt)) < end)
+    {
+        uint64_t next = latest_checkpoint(tt)->position + tt->interval;
+        uint64_t stop = next < end ? next : end;
+
+        reason = vm_run_for(tt->vm, stop > now ? stop - now : 1);
+
+        // A replayed poll that came up empty is answered from the log on
+        // the next slice; only a live wait is worth reporting.
+        bool replayed = !recording(tt);
+        if (!replayed)
+            tt->horizon = position(tt);
+        if (position(tt) >= next)
+            take_checkpoint(tt);
+        if (reason == VM_STOP_IO_WAIT && replayed)
+            continue;
+        if (reason != VM_STOP_BUDGET)
+            break;
+    }
+    return reason;
+}
+
+// Moves to any recorded position by restoring the checkpoint before it
+// and replaying forward. Positions outside the recording leave the VM
+// where it was.
+bool vm_tt_seek(vm_tt_t *tt, uint64_t pos)
+{
+    if (pos < tt->checkpoints[0].position || pos > tt->horizon)
+        return false;
+
+    const tt_checkpoint *ck = checkpoint_before(tt, pos);
+    vm_restore(tt->vm, ck->snap);
+    tt->input_pos = first_input_after(tt, ck->position);
+
+    while (position(tt) < pos)
+    {
+        if (vm_run_for(tt->vm, pos - position(tt)) == VM_STOP_HALT)
+            break;
+    }
+    return position(tt) == pos;
+}
+
+bool vm_tt_step_back(vm_tt_t *tt, uint64_t count)
+{
+    uint64_t now = position(tt);
+    uint64_t start = tt->checkpoints[0].position;
+    return vm_tt_seek(tt, now - start > count ? now - count : start);
+}
+
+// Stops right after the most recent earlier instruction that stored to
+// address.
+bool vm_tt_run_back_to_write(vm_tt_t *tt, uint16_t address)
+{
+    uint64_t now = position(tt);
+
+    for (size_t i = tt->write_count; i > 0; i--)
+    {
+        const tt_write *w = &tt->writes[i - 1];
+        if (w->position < now && w->address == address)
+            return vm_tt_seek(tt, w->position);
+    }
+    return false;
+}
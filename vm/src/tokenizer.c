@@ -281,12 +281,17 @@ void tokenize_file(FILE *file, token_line_t *lines, size_t *line_count)
     char buffer[256];
     int line_num = 1;
 
-    while (fgets(buffer, sizeof(buffer), file))
+    for (; fgets(buffer, sizeof(buffer), file); line_num++)
     {
         trim(buffer);
-        printf("Line: %s\n", buffer);
         if (is_comment(buffer))
             continue;
+
+        // Record the source line, not the instruction index, so errors
+        // and debug maps point into the file.
+        int first = lines->line_count;
         tokenizer(buffer, lines);
+        for (int i = first; i < lines->line_count; i++)
+            lines->instr[i].line_number = line_num;
     }
 }
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pvm/trace.h"
+#include "pvm/utils.h"
+
+// -----------------------------------------------------------------------------
+// Ring
+// -----------------------------------------------------------------------------
+
+/*
+ * vm_trace_create:
+ *   Allocates a ring of `capacity` records (rounded up to a power of two).
+ *   With a path the ring lives in a MAP_SHARED file that tracedump can
+ *   decode, even after the traced process has died; otherwise it is
+ *   anonymous memory.
+ */
+vm_trace_t *vm_trace_create(size_t capacity, const char *path)
+{
+    size_t cap = 1;
+    while (cap < capacity)
+        cap *= 2;
+
+    vm_trace_t *trace = calloc(1, sizeof(vm_trace_t));
+    if (!trace)
+        return NULL;
+
+    size_t len = sizeof(vm_trace_header_t) + cap * sizeof(vm_trace_record_t);
+    int fd = -1;
+    int flags = MAP_SHARED | MAP_ANONYMOUS;
+
+    if (path)
+    {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)len) < 0)
+        {
+            perror(path);
+            if (fd >= 0)
+                close(fd);
+            free(trace);
+            return NULL;
+        }
+        flags = MAP_SHARED;
+    }
+
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("Failed to map trace ring");
+        free(trace);
+        return NULL;
+    }
+
+    trace->hdr = base;
+    trace->records = (vm_trace_record_t *)(trace->hdr + 1);
+    trace->mask = cap - 1;
+    trace->map_len = len;
+    trace->hdr->magic = TRACE_MAGIC;
+    trace->hdr->version = TRACE_VERSION;
+    trace->hdr->record_size = sizeof(vm_trace_record_t);
+    trace->hdr->capacity = (uint32_t)cap;
+    return trace;
+}
+
+// Maps an existing trace file read-only, for decoders. The writer may
+// still be appending to it.
+vm_trace_t *vm_trace_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    vm_trace_header_t hdr;
+    if (read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) || hdr.magic != TRACE_MAGIC ||
+        hdr.version != TRACE_VERSION || hdr.record_size != sizeof(vm_trace_record_t) || hdr.capacity == 0 ||
+        (hdr.capacity & (hdr.capacity - 1)) != 0)
+    {
+        fprintf(stderr, "Error: %s is not a trace file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t len = sizeof(vm_trace_header_t) + (size_t)hdr.capacity * sizeof(vm_trace_record_t);
+    void *base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    vm_trace_t *trace = calloc(1, sizeof(vm_trace_t));
+    if (!trace)
+    {
+        munmap(base, len);
+        return NULL;
+    }
+
+    trace->hdr = base;
+    trace->records = (vm_trace_record_t *)(trace->hdr + 1);
+    trace->mask = hdr.capacity - 1;
+    trace->map_len = len;
+    return trace;
+}
+
+void vm_trace_destroy(vm_trace_t *trace)
+{
+    if (!trace)
+        return;
+    munmap(trace->hdr, trace->map_len);
+    free(trace);
+}
+
+// Copies up to max records starting at *cursor and advances it. If the
+// writer has lapped the cursor, reading resumes at the oldest record still
+// in the ring. Returns 0 only when the cursor has caught up with the writer.
+size_t vm_trace_read(const vm_trace_t *trace, uint64_t *cursor, vm_trace_record_t *out, size_t max)
+{
+    uint64_t cap = trace->mask + 1;
+    if (max == 0)
+        return 0;
+
+    for (;;)
+    {
+        uint64_t head = __atomic_load_n(&trace->hdr->head, __ATOMIC_ACQUIRE);
+        if (head - *cursor > cap)
+            *cursor = head - cap;
+
+        size_t n = 0;
+        while (n < max && *cursor + n < head)
+        {
+            out[n] = trace->records[(*cursor + n) & trace->mask];
+            n++;
+        }
+
+        // If the writer moved while we were copying, anything it reached may
+        // be torn, including the slot it fills before publishing `after + 1`:
+        // logical record after - cap. A writer that stayed put touched
+        // nothing, so a full ring keeps its oldest record. The fence keeps
+        // the copies above from moving past the re-read of head.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t after = __atomic_load_n(&trace->hdr->head, __ATOMIC_RELAXED);
+        if (after != head && after - *cursor >= cap)
+        {
+            size_t lost = (size_t)(after - cap - *cursor + 1);
+            if (lost >= n)
+            {
+                // Everything copied was overwritten; start again from the
+                // oldest record that is still intact.
+                *cursor = after - cap + 1;
+                continue;
+            }
+            memmove(out, out + lost, (n - lost) * sizeof(*out));
+            *cursor += lost;
+            n -= lost;
+        }
+
+        *cursor += n;
+        return n;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Text form
+// -----------------------------------------------------------------------------
+
+static const char *bool_name(bool b)
+{
+    return b ? "true" : "false";
+}
+
+// Prints a record in the interpreter's historical trace format.
+void vm_trace_format(const vm_trace_record_t *rec, bool show_pc, FILE *out)
+{
+    uint16_t w = rec->instr;
+    int dr = (w >> 9) & 0x7;
+    int sr1 = (w >> 6) & 0x7;
+    bool imm = (w >> 5) & 1;
+    int16_t off9 = (int16_t)sign_extend(w & 0x1FF, 9);
+    uint16_t next_pc = rec->pc + 1;
+
+    if (show_pc)
+        fprintf(out, "[0x%04X] ", rec->pc);
+
+    switch (w >> 12)
+    {
+    case 0x1: // ADD
+    case 0x5: // AND
+    {
+        const char *name = (w >> 12) == 0x1 ? "ADD" : "AND";
+        const char *sym = (w >> 12) == 0x1 ? "+" : "&";
+        if (imm)
+            fprintf(out, "%s (immediate): R%d = R%d (%d) %s %d\n", name, dr, sr1, rec->aux, sym,
+                    (int16_t)sign_extend(w & 0x1F, 5));
+        else
+            fprintf(out, "%s (register): R%d = R%d (%d) %s R%d (%d)\n", name, dr, sr1, rec->aux, sym,
+                    w & 0x7, rec->addr);
+        break;
+    }
+
+    case 0x9:
+        fprintf(out, "NOT: R%d = ~R%d (%d) = %d\n", dr, sr1, rec->aux, rec->value);
+        break;
+
+    case 0x0:
+        fprintf(out, "BR: cond_flags=0x%X, offset=%d, should_branch=%s\n", rec->flags & TRACE_COND_MASK, off9,
+                bool_name(rec->flags & TRACE_TAKEN));
+        if (rec->flags & TRACE_TAKEN)
+            fprintf(out, "BR taken: new PC=0x%04X\n", rec->value);
+        break;
+
+    case 0xC:
+        fprintf(out, "JMP: PC <- R%d (0x%04X)\n", sr1, rec->value);
+        break;
+
+    case 0x4:
+        if ((w >> 11) & 1)
+            fprintf(out, "JSR (PC offset): PC <- PC + %d = 0x%04X\n", (int16_t)sign_extend(w & 0x7FF, 11), rec->value);
+        else
+            fprintf(out, "JSR (register): PC <- R%d (0x%04X)\n", sr1, rec->value);
+        break;
+
+    case 0x2:
+        fprintf(out, "LD: Load from 0x%04X value 0x%04X into R%d\n", rec->addr, rec->value, dr);
+        break;
+
+    case 0xA:
+        fprintf(out, "LDI: addr1=0x%04X, addr2=0x%04X, value=0x%04X into R%d\n",
+                (uint16_t)(next_pc + off9), rec->addr, rec->value, dr);
+        break;
+
+    case 0x6:
+        fprintf(out, "LDR: Load from 0x%04X value 0x%04X into R%d\n", rec->addr, rec->value, dr);
+        break;
+
+    case 0xE:
+        fprintf(out, "LEA: Load address 0x%04X into R%d\n", rec->value, dr);
+        break;
+
+    case 0x3:
+        fprintf(out, "ST: Store R%d (0x%04X) into memory address 0x%04X\n", dr, rec->value, rec->addr);
+        break;
+
+    case 0xB:
+        fprintf(out, "STI: pc=0x%04X, addr1=0x%04X (indirect), addr2=0x%04X, value=0x%04X (R%d)\n",
+                next_pc, (uint16_t)(next_pc + off9), rec->addr, rec->value, dr);
+        break;
+
+    case 0x7:
+        fprintf(out, "STR: Store R%d (0x%04X) into memory address 0x%04X (base R%d + offset %d)\n",
+                dr, rec->value, rec->addr, sr1, (int16_t)sign_extend(w & 0x3F, 6));
+        break;
+
+    case 0xF:
+        fprintf(out, "TRAP: trap_vector=0x%02X, handler=0x%04X\n", w & 0xFF, rec->value);
+        if (rec->flags & TRACE_HALT)
+            fprintf(out, "TRAP HALT called, stopping execution\n");
+        break;
+
+    default:
+        fprintf(out, "Unknown or reserved opcode: 0x%X\n", w >> 12);
+        break;
+    }
+}
@@ -10,11 +10,17 @@
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
 
 #include "pvm/vm.h"
+#include "pvm/mmio.h"
 #include "pvm/utils.h"
-
-static struct termios original_tio;
+#include "pvm/trace.h"
+#include "pvm/profile.h"
+#include "pvm/heatmap.h"
+#include "pvm/callgraph.h"
+#include "pvm/coverage.h"
+#include "pvm/debug.h"
 
 #define ADD_MODE_BIT 5
 #define JSR_MODE_BIT 11
@@ -27,6 +33,53 @@ static struct termios original_tio;
 
 #define DSR_READY_MASK 0x7FFF
 
+#define PC_START 0x3000
+
+// Per-instruction trace point. `pc` and `cur_instr` come from run's loop;
+// the record carries R_COND as it stands after the instruction. Level 0
+// compiles every call site away.
+#if PVM_TRACE_LEVEL >= 2
+#define TRACE(value, addr, aux, flags) trace_text(vm, pc, cur_instr, value, addr, aux, flags)
+#elif PVM_TRACE_LEVEL >= 1
+#define TRACE(value, addr, aux, flags)                                                              \
+    do                                                                                              \
+    {                                                                                               \
+        if (vm->trace)                                                                              \
+            vm_trace_emit(vm->trace, pc, cur_instr, value, addr, aux, vm->reg[R_COND] | (flags)); \
+    } while (0)
+#else
+#define TRACE(value, addr, aux, flags) ((void)0)
+#endif
+
+// Observer hooks. Each runs only while its observer is attached to the
+// VM; profilers compile out with PVM_PROFILE=0, coverage with
+// PVM_COVERAGE=0.
+#define VM_HOOK(field, stmt) \
+    do                       \
+    {                        \
+        if (vm->field)       \
+        {                    \
+            stmt;            \
+        }                    \
+    } while (0)
+
+#if PVM_PROFILE
+#define PROFILE(stmt) VM_HOOK(profile, stmt)
+#define CALLGRAPH(stmt) VM_HOOK(callgraph, stmt)
+#define HEATMAP(stmt) VM_HOOK(heatmap, stmt)
+#else
+#define PROFILE(stmt) ((void)0)
+#define CALLGRAPH(stmt) ((void)0)
+#define HEATMAP(stmt) ((void)0)
+#endif
+
+// Records the edge into `target`, the PC a control transfer just set.
+#if PVM_COVERAGE
+#define COVERAGE(target) VM_HOOK(coverage, vm_coverage_edge(vm->coverage, target))
+#else
+#define COVERAGE(target) ((void)0)
+#endif
+
 static inline uint16_t get_bit_at_position(uint16_t value, uint16_t position)
 {
     return (value >> position) & 1;
@@ -39,28 +92,6 @@ typedef enum
     FL_NEG = 1 << 2, /* N */
 } ConditionFlags;
 
-typedef enum
-{
-    OP_BR = 0,
-    OP_ADD,
-    OP_LD,
-    OP_ST,
-    OP_JSR,
-    OP_AND,
-    OP_LDR,
-    OP_STR,
-    OP_RTI,
-    OP_NOT,
-    OP_LDI,
-    OP_STI,
-    OP_JMP,
-    OP_RES,
-    OP_LEA,
-    OP_TRAP,
-    OP_RET = 0xC,
-    OP_INVALID = 0xFFFF
-} OpCode;
-
 typedef struct
 {
     uint8_t dr;
@@ -333,34 +364,140 @@ Instruction decode(uint16_t cur_instr)
     return instr;
 }
 
-int check_key()
+static inline void reg_write(VM *vm, uint16_t dr, uint16_t data) { vm->reg[dr] = data; }
+
+static inline uint16_t reg_read(VM *vm, uint16_t sr) { return vm->reg[sr]; }
+
+// Shared and device pages take the slow path; plain owned pages are a
+// single table lookup.
+static void mem_write_slow(VM *vm, uint16_t dr, uint16_t data)
 {
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(STDIN_FILENO, &readfds);
+    uint8_t attr = vm->page_attr[dr >> VM_PAGE_SHIFT];
+    if (attr & PAGE_WATCH)
+        vm->store_hook.fn(vm->store_hook.ctx, dr, data);
+    if ((attr & PAGE_WATCHPOINT) && vm->debug)
+        vm_debug_access(vm->debug, dr, data, VM_WATCH_WRITE);
+
+    if (dr >= MMIO_BASE)
+    {
+        PROFILE(vm->profile->mmio_stores[dr - MMIO_BASE]++);
 
-    struct timeval timeout = {0}; // No wait (poll)
-    return select(1, &readfds, NULL, NULL, &timeout) > 0;
+        mmio_device_t *dev = mmio_find(vm, dr);
+        if (dev)
+        {
+            if (dev->write)
+                dev->write(dev, vm, dr - dev->base, data);
+            return;
+        }
+    }
+    vm_poke(vm, dr, data);
 }
 
-static inline void reg_write(VM *vm, uint16_t dr, uint16_t data) { vm->reg[dr] = data; }
+static inline void mem_write(VM *vm, uint16_t dr, uint16_t data)
+{
+    HEATMAP(vm_heatmap_store(vm->heatmap, dr));
 
-static inline uint16_t reg_read(VM *vm, uint16_t sr) { return vm->reg[sr]; }
+    uint8_t page = dr >> VM_PAGE_SHIFT;
+    if (vm->page_attr[page])
+    {
+        mem_write_slow(vm, dr, data);
+        return;
+    }
+    vm->pages[page][dr & (VM_PAGE_WORDS - 1)] = data;
+}
 
-static inline void mem_write(VM *vm, uint16_t dr, uint16_t data) { vm->mem[dr] = data; }
+// The keyboard is only polled when the guest looks at KBSR, so a program
+// that never reads input costs no host I/O at all.
+static void poll_keyboard(VM *vm)
+{
+    if (vm_peek(vm, KBSR) & 0x8000)
+        return;
 
-static inline uint16_t mem_read(VM *vm, uint16_t address)
+    int ch = vm->io.getc ? vm->io.getc(vm->io.ctx) : -1;
+    if (ch >= 0)
+    {
+        vm_poke(vm, KBSR, 0x8000);
+        vm_poke(vm, KBDR, (uint16_t)ch);
+    }
+    else
+    {
+        vm_wait_on(vm, VM_WAIT_KEYBOARD, KBSR, NULL);
+    }
+}
+
+// Loads from device and packed pages, without watchpoint checks; also
+// serves instruction fetches.
+static uint16_t bus_read(VM *vm, uint16_t address)
 {
-    if (address == KBDR)
+    if (address < MMIO_BASE)
+        return vm_peek(vm, address);
+
+    mmio_device_t *dev = mmio_find(vm, address);
+    if (dev)
+        return dev->read(dev, vm, address - dev->base);
+
+    if (address == KBSR)
+    {
+        poll_keyboard(vm);
+    }
+    else if (address == KBDR)
     {
-        vm->mem[KBSR] = 0;
+        vm_poke(vm, KBSR, 0);
     }
-    else if (address == DSR)
+
+    return vm_peek(vm, address);
+}
+
+// Only data loads count towards the device profile; fetches from the
+// register window go through bus_read directly.
+static uint16_t mem_read_slow(VM *vm, uint16_t address)
+{
+    if (address >= MMIO_BASE)
+        PROFILE(vm->profile->mmio_loads[address - MMIO_BASE]++);
+
+    uint16_t value = bus_read(vm, address);
+    if ((vm->page_attr[address >> VM_PAGE_SHIFT] & PAGE_WATCHPOINT) && vm->debug)
+        vm_debug_access(vm->debug, address, value, VM_WATCH_READ);
+    return value;
+}
+
+static inline uint16_t mem_read(VM *vm, uint16_t address)
+{
+    HEATMAP(vm_heatmap_load(vm->heatmap, address));
+
+    uint8_t page = address >> VM_PAGE_SHIFT;
+    if (vm->page_attr[page] & (PAGE_MMIO | PAGE_PACKED | PAGE_WATCHPOINT))
+        return mem_read_slow(vm, address);
+    return vm->pages[page][address & (VM_PAGE_WORDS - 1)];
+}
+
+typedef enum
+{
+    FETCH_OK = 0,
+    FETCH_BREAK,  // breakpoint: stop before the instruction runs
+    FETCH_NATIVE, // the native OUT handler
+} fetch_result;
+
+static fetch_result fetch_slow(VM *vm, uint16_t pc, uint16_t *word)
+{
+    if (vm->page_attr[pc >> VM_PAGE_SHIFT] & PAGE_BREAK)
     {
-        return vm->mem[DSR];
+        if (vm->debug && vm_debug_fetch(vm->debug, pc))
+            return FETCH_BREAK;
     }
+    *word = bus_read(vm, pc);
+    return pc == VM_NATIVE_OUT ? FETCH_NATIVE : FETCH_OK;
+}
 
-    return vm->mem[address];
+// Instruction fetch. Only PAGE_BREAK pages (and device or packed pages)
+// leave the fast path, so breakpoints cost nothing elsewhere.
+static inline fetch_result fetch(VM *vm, uint16_t pc, uint16_t *word)
+{
+    uint8_t page = pc >> VM_PAGE_SHIFT;
+    if (vm->page_attr[page] & (PAGE_MMIO | PAGE_PACKED | PAGE_BREAK))
+        return fetch_slow(vm, pc, word);
+    *word = vm->pages[page][pc & (VM_PAGE_WORDS - 1)];
+    return FETCH_OK;
 }
 
 void load_program(VM *vm, uint16_t *program, size_t size)
@@ -374,95 +511,145 @@ void load_program(VM *vm, uint16_t *program, size_t size)
 
         while (i < size && (program[i] & 0xF000) != 0xF000)
         {
-            vm->mem[origin++] = program[i++];
+            vm_poke(vm, origin++, program[i++]);
         }
     }
 
     vm->reg[R_PC] = 0x3000;
 }
 
-int getch_async()
+void trap_out(VM *vm)
+{
+    vm_poke(vm, DSR, vm_peek(vm, DSR) & DSR_READY_MASK);
+    uint16_t ch = vm->reg[0];
+    if (vm->io.putc)
+        vm->io.putc(vm->io.ctx, (char)ch);
+    vm_poke(vm, DSR, vm_peek(vm, DSR) | 0x8000);
+    vm_poke(vm, DSR, vm_peek(vm, DSR) & DSR_READY_MASK);
+    vm->reg[R_PC] = vm->reg[R_R7];
+}
+
+VM *vm_create(void)
 {
-    struct termios oldt, newt;
-    int ch;
-    int oldf;
+    VM *vm = malloc(sizeof(VM));
+    if (!vm)
+        return NULL;
+    if (!vm_init(vm))
+    {
+        free(vm);
+        return NULL;
+    }
+    return vm;
+}
 
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
+VM *vm_create_sparse(void)
+{
+    VM *vm = malloc(sizeof(VM));
+    if (!vm)
+        return NULL;
+    vm_init_sparse(vm);
+    return vm;
+}
 
-    ch = getchar();
+void vm_destroy(VM *vm)
+{
+    if (!vm)
+        return;
+    vm_release(vm);
+    free(vm);
+}
 
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    fcntl(STDIN_FILENO, F_SETFL, oldf);
+void vm_load(VM *vm, segment_t *segments, uint16_t entry)
+{
+    vm_load_segments(vm, segments);
+    vm->reg[R_PC] = entry;
+    vm->reg[R_COND] = FL_ZRO;
+    vm->halted = false;
+}
 
-    if (ch != EOF)
-        return ch;
-    return 0;
+void vm_set_io(VM *vm, vm_io_t io)
+{
+    vm->io = io;
 }
 
-void check_key_input(VM *vm)
+// Called by devices when the guest polls something that is not ready. The
+// current instruction still retires; the slice ends right after it.
+void vm_wait_on(VM *vm, vm_wait_kind kind, uint16_t address, struct mmio_device *device)
 {
-    int c = getch_async();
-    if (c > 0)
-    {
-        vm->mem[KBSR] = 0x8000;
-        vm->mem[KBDR] = (uint16_t)c;
-    }
-    else
+    vm->wait = (vm_wait_t){.kind = kind, .address = address, .device = device};
+    vm->stop = VM_STOP_IO_WAIT;
+}
+
+const char *vm_stop_reason_name(vm_stop_reason reason)
+{
+    switch (reason)
     {
-        vm->mem[KBSR] = 0;
+    case VM_STOP_BUDGET:
+        return "budget";
+    case VM_STOP_HALT:
+        return "halt";
+    case VM_STOP_IO_WAIT:
+        return "io-wait";
+    case VM_STOP_BREAKPOINT:
+        return "breakpoint";
+    case VM_STOP_WATCHPOINT:
+        return "watchpoint";
+    case VM_STOP_ERROR:
+        return "error";
+    default:
+        return "none";
     }
 }
 
-void trap_out(VM *vm)
+#if PVM_TRACE_LEVEL >= 2
+// Debug builds keep the old console trace, decoded from the same record.
+static void trace_text(VM *vm, uint16_t pc, uint16_t instr, uint16_t value, uint16_t addr, uint16_t aux,
+                       uint16_t flags)
 {
-    vm->mem[DSR] &= DSR_READY_MASK;
-    uint16_t ch = vm->reg[0];
-    putchar((char)ch);
-    fflush(stdout);
-    vm->mem[DSR] |= 0x8000;
-    vm->mem[DSR] &= DSR_READY_MASK;
-    vm->reg[R_PC] = vm->reg[R_R7];
+    vm_trace_record_t rec = {pc, instr, value, addr, aux, (uint16_t)(vm->reg[R_COND] | flags)};
+    if (vm->trace)
+        vm_trace_emit(vm->trace, rec.pc, rec.instr, rec.value, rec.addr, rec.aux, rec.flags);
+    vm_trace_format(&rec, false, stderr);
 }
-
-void run(VM *vm)
+#endif
+
+/*
+ * vm_run_for:
+ *   Executes at most max_instructions and returns why it stopped. An
+ *   I/O wait stop happens after the polling instruction retires, so calling
+ *   vm_run_for again simply re-runs the guest's poll loop.
+ */
+vm_stop_reason vm_run_for(VM *vm, uint64_t max_instructions)
 {
-    enum
-    {
-        PC_START = 0x3000
-    };
-    vm->reg[R_PC] = PC_START;
-    vm->reg[R_COND] = FL_ZRO;
+    if (vm->halted)
+        return VM_STOP_HALT;
 
-    int running = 1;
+    vm->stop = VM_STOP_NONE;
+    vm->wait.kind = VM_WAIT_NONE;
 
-    while (running)
-    {
+    // Only a slice resuming at the breakpoint it stopped on steps over it.
+    if (vm->debug && vm->debug->resume != vm->reg[R_PC])
+        vm->debug->resume = VM_DEBUG_NO_RESUME;
 
+    for (uint64_t executed = 0; executed < max_instructions; executed++)
+    {
         uint16_t pc = vm->reg[R_PC];
+        uint16_t cur_instr;
 
-        int ch = getch_async();
+        fetch_result fetched = fetch(vm, pc, &cur_instr);
+        if (fetched == FETCH_BREAK)
+            return VM_STOP_BREAKPOINT;
 
-        if (vm->mem[KBSR] == 0)
-        {
-            if (ch > 0)
-            {
-                vm->mem[KBSR] = 0x8000;
-                vm->mem[KBDR] = (uint16_t)ch;
-            }
-        }
-
-        uint16_t cur_instr = mem_read(vm, pc);
         Instruction instr = decode(cur_instr);
         vm->reg[R_PC]++;
+        vm->counters.instructions++;
+        PROFILE(vm_profile_insn(vm->profile, pc, cur_instr));
 
-        if (pc == 0x0106)
+        if (fetched == FETCH_NATIVE)
         {
             trap_out(vm);
+            CALLGRAPH(vm_callgraph_return(vm->callgraph, vm->reg[R_PC])); // stands in for the handler's RET
+            COVERAGE(vm->reg[R_PC]);
             continue;
         }
 
@@ -475,14 +662,14 @@ void run(VM *vm)
 
             if (instr.add.is_immediate)
             {
-                printf("ADD (immediate): R%d = R%d (%d) + %d\n", instr.add.dr, instr.add.sr1, left, instr.add.imm5);
                 result = left + instr.add.imm5;
+                TRACE(result, 0, left, 0);
             }
             else
             {
                 uint16_t right = vm->reg[instr.add.sr2];
-                printf("ADD (register): R%d = R%d (%d) + R%d (%d)\n", instr.add.dr, instr.add.sr1, left, instr.add.sr2, right);
                 result = left + right;
+                TRACE(result, right, left, 0);
             }
 
             reg_write(vm, instr.add.dr, result);
@@ -497,14 +684,14 @@ void run(VM *vm)
 
             if (instr.and.is_immediate)
             {
-                printf("AND (immediate): R%d = R%d (%d) & %d\n", instr.and.dr, instr.and.sr1, left, instr.and.imm5);
                 result = left & instr.and.imm5;
+                TRACE(result, 0, left, 0);
             }
             else
             {
                 uint16_t right = vm->reg[instr.and.sr2];
-                printf("AND (register): R%d = R%d (%d) & R%d (%d)\n", instr.and.dr, instr.and.sr1, left, instr.and.sr2, right);
                 result = left & right;
+                TRACE(result, right, left, 0);
             }
 
             reg_write(vm, instr.and.dr, result);
@@ -516,10 +703,9 @@ void run(VM *vm)
         {
             uint16_t value = vm->reg[instr.not.sr];
             uint16_t result = ~value;
-            printf("NOT: R%d = ~R%d (%d) = %d\n", instr.not.dr, instr.not.sr, value, result);
-
             reg_write(vm, instr.not.dr, result);
             update_flags(vm, instr.not.dr);
+            TRACE(result, 0, value, 0);
             break;
         }
 
@@ -533,21 +719,26 @@ void run(VM *vm)
                 (instr.br.z && (cond_flags & FL_ZRO)) ||
                 (instr.br.p && (cond_flags & FL_POS));
 
-            printf("BR: cond_flags=0x%X, offset=%d, should_branch=%s\n", cond_flags, offset, should_branch ? "true" : "false");
+            PROFILE(should_branch ? vm->profile->br_taken[pc]++ : vm->profile->br_not_taken[pc]++);
 
             if (should_branch)
             {
+                vm->counters.branches++;
                 vm->reg[R_PC] += offset;
-                printf("BR taken: new PC=0x%04X\n", vm->reg[R_PC]);
             }
+            COVERAGE(vm->reg[R_PC]);
+            TRACE(vm->reg[R_PC], 0, 0, should_branch ? TRACE_TAKEN : 0);
             break;
         }
 
         case OP_JMP:
         {
             uint16_t base_address = vm->reg[instr.jmp.base_r];
-            printf("JMP: PC <- R%d (0x%04X)\n", instr.jmp.base_r, base_address);
             vm->reg[R_PC] = base_address;
+            if (instr.jmp.base_r == R_R7)
+                CALLGRAPH(vm_callgraph_return(vm->callgraph, base_address));
+            COVERAGE(base_address);
+            TRACE(base_address, 0, 0, 0);
             break;
         }
 
@@ -560,14 +751,15 @@ void run(VM *vm)
             {
                 int16_t offset = instr.jsr.pc_offset11;
                 vm->reg[R_PC] += offset;
-                printf("JSR (PC offset): PC <- PC + %d = 0x%04X\n", offset, vm->reg[R_PC]);
             }
             else
             {
                 uint16_t base_address = vm->reg[instr.jsr.base_r];
                 vm->reg[R_PC] = base_address;
-                printf("JSR (register): PC <- R%d (0x%04X)\n", instr.jsr.base_r, base_address);
             }
+            CALLGRAPH(vm_callgraph_call(vm->callgraph, vm->reg[R_PC], return_address));
+            COVERAGE(vm->reg[R_PC]);
+            TRACE(vm->reg[R_PC], 0, 0, 0);
             break;
         }
 
@@ -575,10 +767,10 @@ void run(VM *vm)
         {
             uint16_t addr = vm->reg[R_PC] + instr.ld.pc_offset9;
             uint16_t value = mem_read(vm, addr);
-            printf("LD: Load from 0x%04X value 0x%04X into R%d\n", addr, value, instr.ld.dr);
-
+            vm->counters.loads++;
             reg_write(vm, instr.ld.dr, value);
             update_flags(vm, instr.ld.dr);
+            TRACE(value, addr, 0, 0);
             break;
         }
 
@@ -587,11 +779,11 @@ void run(VM *vm)
             uint16_t addr1 = vm->reg[R_PC] + instr.ldi.pc_offset9;
             uint16_t addr2 = mem_read(vm, addr1);
             uint16_t value = mem_read(vm, addr2);
-
-            printf("LDI: addr1=0x%04X, addr2=0x%04X, value=0x%04X into R%d\n", addr1, addr2, value, instr.ldi.dr);
+            vm->counters.loads += 2;
 
             reg_write(vm, instr.ldi.dr, value);
             update_flags(vm, instr.ldi.dr);
+            TRACE(value, addr2, 0, 0);
             break;
         }
 
@@ -601,21 +793,20 @@ void run(VM *vm)
             int16_t offset = instr.ldr.offset6;
             uint16_t addr = base + offset;
             uint16_t value = mem_read(vm, addr);
-
-            printf("LDR: Load from 0x%04X value 0x%04X into R%d\n", addr, value, instr.ldr.dr);
+            vm->counters.loads++;
 
             reg_write(vm, instr.ldr.dr, value);
             update_flags(vm, instr.ldr.dr);
+            TRACE(value, addr, base, 0);
             break;
         }
 
         case OP_LEA:
         {
             uint16_t addr = vm->reg[R_PC] + instr.lea.pc_offset9;
-            printf("LEA: Load address 0x%04X into R%d\n", addr, instr.lea.dr);
-
             reg_write(vm, instr.lea.dr, addr);
             update_flags(vm, instr.lea.dr);
+            TRACE(addr, addr, 0, 0);
             break;
         }
 
@@ -623,23 +814,22 @@ void run(VM *vm)
         {
             uint16_t addr = vm->reg[R_PC] + instr.st.pc_offset9;
             uint16_t value = vm->reg[instr.st.sr];
-            printf("ST: Store R%d (0x%04X) into memory address 0x%04X\n", instr.st.sr, value, addr);
-
             mem_write(vm, addr, value);
+            vm->counters.stores++;
+            TRACE(value, addr, 0, 0);
             break;
         }
 
         case OP_STI:
         {
-            uint16_t pc = vm->reg[R_PC];
-            uint16_t addr1 = pc + instr.st.pc_offset9;
+            uint16_t addr1 = vm->reg[R_PC] + instr.st.pc_offset9;
             uint16_t addr2 = mem_read(vm, addr1);
             uint16_t value = vm->reg[instr.st.sr];
-
-            printf("STI: pc=0x%04X, addr1=0x%04X (indirect), addr2=0x%04X, value=0x%04X (R%d)\n",
-                   pc, addr1, addr2, value, instr.st.sr);
+            vm->counters.loads++;
 
             mem_write(vm, addr2, value);
+            vm->counters.stores++;
+            TRACE(value, addr2, addr1, 0);
             break;
         }
 
@@ -650,10 +840,9 @@ void run(VM *vm)
             uint16_t addr = base + offset;
             uint16_t value = vm->reg[instr.str.sr];
 
-            printf("STR: Store R%d (0x%04X) into memory address 0x%04X (base R%d + offset %d)\n",
-                   instr.str.sr, value, addr, instr.str.base_r, offset);
-
             mem_write(vm, addr, value);
+            vm->counters.stores++;
+            TRACE(value, addr, base, 0);
             break;
         }
 
@@ -664,16 +853,19 @@ void run(VM *vm)
 
             uint16_t trap_vector = instr.trap.trap_vec8;
             uint16_t trap_routine_address = mem_read(vm, trap_vector);
-
-            printf("TRAP: trap_vector=0x%02X, handler=0x%04X\n", trap_vector, trap_routine_address);
+            vm->counters.traps++;
 
             vm->reg[R_PC] = trap_routine_address;
+            CALLGRAPH(vm_callgraph_call(vm->callgraph, trap_routine_address, return_address));
+            COVERAGE(trap_routine_address);
 
             if (trap_vector == 0x25)
             {
-                printf("TRAP HALT called, stopping execution\n");
-                running = 0;
+                vm->halted = true;
+                vm->stop = VM_STOP_HALT;
+                PROFILE(if (vm->profile->dump_at_halt) vm_profile_dump(vm->profile, vm->profile->dump_at_halt));
             }
+            TRACE(trap_routine_address, trap_vector, 0, trap_vector == 0x25 ? TRACE_HALT : 0);
             break;
         }
 
@@ -681,8 +873,37 @@ void run(VM *vm)
         case OP_RTI:
         default:
             // Invalid or OS-level instruction, do nothing
-            printf("Unknown or reserved opcode: 0x%X\n", instr.op);
+            TRACE(0, 0, 0, 0);
             break;
         }
+
+        if (vm->stop)
+            return vm->stop;
+    }
+
+    return VM_STOP_BUDGET;
+}
+
+// Compatibility driver: boots at x3000 on the calling terminal and runs to
+// HALT, sleeping in poll() rather than spinning while the guest waits.
+void run(VM *vm)
+{
+    vm_term_t term;
+    vm_term_open(&term, STDIN_FILENO, STDOUT_FILENO);
+
+    vm_io_t saved_io = vm->io;
+    vm->io = vm_io_terminal(&term);
+    vm->reg[R_PC] = PC_START;
+    vm->reg[R_COND] = FL_ZRO;
+    vm->halted = false;
+
+    vm_stop_reason reason;
+    while ((reason = vm_run_for(vm, UINT64_MAX)) != VM_STOP_HALT)
+    {
+        if (reason == VM_STOP_IO_WAIT && !vm_term_wait(&term, -1))
+            break;
     }
+
+    vm->io = saved_io;
+    vm_term_close(&term);
 }
\ No newline at end of file
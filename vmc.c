@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pvm/rpc.h"
+#include "pvm/vm.h"
+
+// vmc: minimal vmd client for testing and latency measurement.
+//
+//   vmc [-s socket] [-b budget] [-n repeat] image [input-file]
+//
+// Guest output goes to stdout; stop reason, instruction count and the
+// mean round-trip time go to stderr.
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint8_t *read_input(const char *path, size_t *len)
+{
+    *len = 0;
+    if (!path)
+        return NULL;
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    // Read to EOF rather than trusting ftell, which fails on pipes.
+    size_t cap = 4096;
+    uint8_t *data = malloc(cap);
+    size_t n;
+    while (data && (n = fread(data + *len, 1, cap - *len, f)) > 0)
+    {
+        *len += n;
+        if (*len < cap)
+            continue;
+
+        uint8_t *bigger = realloc(data, cap * 2);
+        if (!bigger)
+        {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = bigger;
+        cap *= 2;
+    }
+    fclose(f);
+
+    if (!data)
+    {
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+        exit(1);
+    }
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = RPC_DEFAULT_SOCKET;
+    uint64_t budget = 0;
+    unsigned long repeat = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:b:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'b':
+            budget = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            repeat = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: vmc [-s socket] [-b budget] [-n repeat] image [input-file]\n");
+            return 1;
+        }
+    }
+
+    if (optind >= argc || repeat == 0)
+    {
+        fprintf(stderr, "usage: vmc [-s socket] [-b budget] [-n repeat] image [input-file]\n");
+        return 1;
+    }
+
+    size_t input_len;
+    uint8_t *input = read_input(optind + 1 < argc ? argv[optind + 1] : NULL, &input_len);
+
+    int fd = rpc_connect(socket_path);
+    if (fd < 0)
+        return 1;
+
+    rpc_request_t req = {
+        .magic = RPC_MAGIC,
+        .image = (uint32_t)strtoul(argv[optind], NULL, 10),
+        .budget = budget,
+        .input_len = (uint32_t)input_len};
+    rpc_response_t resp;
+    uint8_t *output = NULL;
+    uint64_t total = 0;
+
+    for (unsigned long i = 0; i < repeat; i++)
+    {
+        free(output);
+        uint64_t start = now_ns();
+        if (!rpc_send_request(fd, &req, input) || !rpc_recv_response(fd, &resp, &output))
+        {
+            fprintf(stderr, "Error: lost connection to vmd\n");
+            return 1;
+        }
+        total += now_ns() - start;
+    }
+
+    if (resp.status != RPC_OK)
+    {
+        fprintf(stderr, "Error: vmd returned status %u\n", resp.status);
+        return 1;
+    }
+
+    fwrite(output, 1, resp.output_len, stdout);
+    if (resp.flags & RPC_OUTPUT_TRUNCATED)
+        fprintf(stderr, "Warning: output truncated at %u bytes\n", resp.output_len);
+    fprintf(stderr, "reason=%s instructions=%llu run=%lluns round-trip=%lluns (mean of %lu)\n",
+            vm_stop_reason_name((vm_stop_reason)resp.reason),
+            (unsigned long long)resp.instructions,
+            (unsigned long long)resp.run_ns,
+            (unsigned long long)(total / repeat), repeat);
+
+    free(output);
+    free(input);
+    close(fd);
+    return 0;
+}
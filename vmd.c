@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "pvm/assembler.h"
+#include "pvm/memory.h"
+#include "pvm/rpc.h"
+#include "pvm/snapfile.h"
+#include "pvm/stats.h"
+#include "pvm/vm.h"
+
+// vmd: keep assembled images and ready-to-run VMs warm, and serve run
+// requests over a UNIX socket.
+//
+//   vmd [-s socket] [-t traps.asm] [-b budget] [-w warm] [-m /stats] image...
+//
+// Each image is either a program to assemble or a snapshot file written by
+// snap (*.snap), which is mapped as-is. Image ids are the positions of the
+// images on the command line. -m publishes live counters in that shared
+// memory segment for pvmstat.
+
+#define DEFAULT_BUDGET 10000000ULL
+
+typedef struct
+{
+    vm_snapshot_t *golden; // loaded and ready at the entry point
+    VM **pool;             // idle VMs, restored from golden before each run
+    size_t pool_len;
+    size_t pool_cap;
+} image_t;
+
+typedef struct
+{
+    image_t *images;
+    size_t image_count;
+    uint64_t budget;
+    vm_stats_t *stats;    // NULL unless -m
+    pthread_mutex_t lock; // guards every pool
+} daemon_t;
+
+typedef struct
+{
+    daemon_t *d;
+    int fd;
+} connection_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static VM *pool_take(daemon_t *d, image_t *img)
+{
+    VM *vm = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (img->pool_len > 0)
+        vm = img->pool[--img->pool_len];
+    pthread_mutex_unlock(&d->lock);
+    return vm ? vm : vm_fork(img->golden);
+}
+
+static void pool_put(daemon_t *d, image_t *img, VM *vm)
+{
+    pthread_mutex_lock(&d->lock);
+    if (img->pool_len == img->pool_cap)
+    {
+        size_t cap = img->pool_cap ? img->pool_cap * 2 : 8;
+        VM **pool = realloc(img->pool, cap * sizeof(VM *));
+        if (!pool)
+        {
+            pthread_mutex_unlock(&d->lock);
+            vm_destroy(vm);
+            return;
+        }
+        img->pool = pool;
+        img->pool_cap = cap;
+    }
+    img->pool[img->pool_len++] = vm;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void serve_request(daemon_t *d, int fd, const rpc_request_t *req, const uint8_t *input)
+{
+    rpc_response_t resp = {.magic = RPC_MAGIC, .status = RPC_OK};
+    vm_membuf_t io;
+    vm_membuf_init(&io, input, req->input_len);
+    io.out_max = RPC_MAX_PAYLOAD; // anything longer the client would reject
+
+    if (req->image >= d->image_count)
+    {
+        resp.status = RPC_BAD_IMAGE;
+        rpc_send_response(fd, &resp, NULL);
+        return;
+    }
+
+    image_t *img = &d->images[req->image];
+    VM *vm = pool_take(d, img);
+    if (!vm)
+    {
+        resp.status = RPC_BUSY;
+        rpc_send_response(fd, &resp, NULL);
+        return;
+    }
+
+    vm_restore(vm, img->golden);
+    vm_set_io(vm, vm_io_memory(&io));
+
+    vm_counters_t before = vm->counters;
+    uint64_t start = now_ns();
+    resp.reason = vm_run_for(vm, req->budget ? req->budget : d->budget);
+    resp.run_ns = now_ns() - start;
+    if (d->stats)
+        vm_stats_slice(d->stats, 0, &before, vm, resp.reason);
+    resp.instructions = vm->counters.instructions;
+    resp.output_len = (uint32_t)io.out_len;
+    if (io.truncated)
+        resp.flags |= RPC_OUTPUT_TRUNCATED;
+
+    pool_put(d, img, vm);
+    rpc_send_response(fd, &resp, io.out);
+    vm_membuf_free(&io);
+}
+
+static void *connection_main(void *arg)
+{
+    connection_t *conn = arg;
+    rpc_request_t req;
+    uint8_t *input;
+
+    while (rpc_recv_request(conn->fd, &req, &input))
+    {
+        serve_request(conn->d, conn->fd, &req, input);
+        free(input);
+    }
+
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static vm_snapshot_t *boot_program(segment_t *os, const char *path)
+{
+    segment_t *program = assemble_file(path);
+    if (!program)
+        return NULL;
+
+    VM *boot = vm_create_sparse();
+    if (!boot)
+        return NULL;
+    if (os)
+        vm_load_segments(boot, os);
+    vm_load(boot, program, 0x3000);
+    free_segments(program);
+
+    vm_snapshot_t *snap = vm_snapshot(boot);
+    vm_destroy(boot);
+    return snap;
+}
+
+static bool is_snapshot_file(const char *path)
+{
+    size_t len = strlen(path);
+    return len > 5 && strcmp(path + len - 5, ".snap") == 0;
+}
+
+static bool load_image(image_t *img, segment_t *os, const char *path, size_t warm)
+{
+    img->golden = is_snapshot_file(path) ? vm_snapshot_load(path) : boot_program(os, path);
+    if (!img->golden)
+        return false;
+
+    img->pool = calloc(warm ? warm : 1, sizeof(VM *));
+    img->pool_cap = warm ? warm : 1;
+    for (size_t i = 0; i < warm; i++)
+    {
+        VM *vm = vm_fork(img->golden);
+        if (!vm)
+            break;
+        img->pool[img->pool_len++] = vm;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = RPC_DEFAULT_SOCKET;
+    const char *traps = NULL;
+    const char *stats_name = NULL;
+    size_t warm = 4;
+    daemon_t d = {.budget = DEFAULT_BUDGET};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:b:w:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 't':
+            traps = optarg;
+            break;
+        case 'b':
+            d.budget = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            warm = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            stats_name = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: vmd [-s socket] [-t traps.asm] [-b budget] [-w warm] [-m /stats] image...\n");
+            return 1;
+        }
+    }
+
+    if (optind == argc)
+    {
+        fprintf(stderr, "usage: vmd [-s socket] [-t traps.asm] [-b budget] [-w warm] [-m /stats] image...\n");
+        return 1;
+    }
+
+    segment_t *os = traps ? assemble_file(traps) : NULL;
+    if (traps && !os)
+        return 1;
+
+    d.image_count = (size_t)(argc - optind);
+    d.images = calloc(d.image_count, sizeof(image_t));
+    for (size_t i = 0; i < d.image_count; i++)
+    {
+        if (!load_image(&d.images[i], os, argv[optind + i], warm))
+        {
+            fprintf(stderr, "Error: failed to load image %zu (%s)\n", i, argv[optind + i]);
+            return 1;
+        }
+    }
+    free_segments(os);
+
+    if (stats_name && !(d.stats = vm_stats_create(stats_name, 1)))
+        return 1;
+
+    pthread_mutex_init(&d.lock, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = rpc_listen(socket_path);
+    if (listen_fd < 0)
+        return 1;
+    fprintf(stderr, "vmd: serving %zu image(s) on %s\n", d.image_count, socket_path);
+
+    for (;;)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        connection_t *conn = malloc(sizeof(connection_t));
+        pthread_t thread;
+        if (!conn)
+        {
+            close(fd);
+            continue;
+        }
+        conn->d = &d;
+        conn->fd = fd;
+        if (pthread_create(&thread, NULL, connection_main, conn) != 0)
+        {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pvm/assembler.h"
+#include "pvm/coverage.h"
+#include "pvm/memory.h"
+#include "pvm/vm.h"
+
+// vmfuzz: coverage-guided fuzzing of a program's keyboard input.
+//
+//   vmfuzz [-t traps.asm] [-e entry] [-b budget] [-n execs] [-l max_len] [-s seed] [-o dir] prog.asm [seed ...]
+//
+// Each execution forks the booted program, feeds it one input from memory
+// and keeps the input if it reached new edges or new hit counts. Inputs
+// that exhaust the budget are counted as hangs. With -o every kept input
+// is written to dir/id-NNNNNN. Needs a PVM_COVERAGE build.
+
+#define MAX_CORPUS 4096
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+} input_t;
+
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: vmfuzz [-t traps.asm] [-e entry] [-b budget] [-n execs] [-l max_len] [-s seed] [-o dir] "
+                    "prog.asm [seed ...]\n");
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool read_input(const char *path, input_t *in, size_t max_len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+    in->data = malloc(max_len ? max_len : 1);
+    in->len = in->data ? fread(in->data, 1, max_len, f) : 0;
+    if (in->data && in->len == max_len && fgetc(f) != EOF)
+        fprintf(stderr, "Warning: seed %s is longer than %zu bytes (-l) and was truncated\n", path, max_len);
+    fclose(f);
+
+    if (!in->data)
+        fprintf(stderr, "Error: out of memory reading %s\n", path);
+    return in->data != NULL;
+}
+
+static void save_input(const char *dir, size_t id, const input_t *in)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/id-%06zu", dir, id);
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        perror(path);
+        return;
+    }
+    fwrite(in->data, 1, in->len, f);
+    fclose(f);
+}
+
+// Applies one to four random edits: bit flips, byte overwrites (biased to
+// printable characters and newlines, since guests read text), inserts and
+// deletes.
+static void mutate(input_t *in, size_t max_len)
+{
+    size_t edits = 1 + next_random() % 4;
+
+    for (size_t i = 0; i < edits; i++)
+    {
+        uint64_t r = next_random();
+        size_t pos = in->len ? (size_t)(r >> 8) % in->len : 0;
+        uint8_t byte = (r >> 40) % 8 == 0 ? '\n' : (uint8_t)(0x20 + (r >> 48) % 95);
+
+        switch (r % 4)
+        {
+        case 0:
+            if (in->len)
+                in->data[pos] ^= (uint8_t)(1u << ((r >> 32) % 8));
+            break;
+        case 1:
+            if (in->len)
+                in->data[pos] = byte;
+            break;
+        case 2:
+            if (in->len < max_len)
+            {
+                memmove(in->data + pos + 1, in->data + pos, in->len - pos);
+                in->data[pos] = byte;
+                in->len++;
+            }
+            break;
+        default:
+            if (in->len)
+            {
+                memmove(in->data + pos, in->data + pos + 1, in->len - pos - 1);
+                in->len--;
+            }
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *traps = NULL;
+    const char *out_dir = NULL;
+    uint16_t entry = 0x3000;
+    uint64_t budget = 1000000;
+    uint64_t execs = 100000;
+    size_t max_len = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:e:b:n:l:s:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            traps = optarg;
+            break;
+        case 'e':
+            entry = (uint16_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            budget = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            execs = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            max_len = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            rng = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc || max_len == 0)
+    {
+        usage();
+        return 1;
+    }
+
+#if !PVM_COVERAGE
+    fprintf(stderr, "Error: vmfuzz needs a build with PVM_COVERAGE enabled\n");
+    return 1;
+#endif
+
+    segment_t *os = traps ? assemble_file(traps) : NULL;
+    segment_t *program = assemble_file(argv[optind]);
+    if ((traps && !os) || !program)
+        return 1;
+
+    VM *vm = vm_create_sparse();
+    if (!vm)
+        return 1;
+    if (os)
+        vm_load_segments(vm, os);
+    vm_load(vm, program, entry);
+    free_segments(os);
+    free_segments(program);
+
+    vm_snapshot_t *boot = vm_snapshot(vm);
+    uint8_t *seen = calloc(VM_COV_SIZE, 1);
+    input_t *corpus = calloc(MAX_CORPUS, sizeof(input_t));
+    uint8_t *scratch = malloc(max_len);
+    if (!boot || !seen || !corpus || !scratch || !(vm->coverage = vm_coverage_create()))
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    size_t corpus_count = 0;
+    for (int i = optind + 1; i < argc && corpus_count < MAX_CORPUS; i++)
+    {
+        if (read_input(argv[i], &corpus[corpus_count], max_len))
+            corpus_count++;
+    }
+    if (corpus_count == 0)
+        corpus[corpus_count++] = (input_t){malloc(max_len), 0};
+
+    // Seeds define the starting coverage; all of them stay in the corpus.
+    for (size_t i = 0; i < corpus_count; i++)
+    {
+        vm_coverage_run(vm, boot, corpus[i].data, corpus[i].len, budget);
+        vm_coverage_merge(seen, vm->coverage);
+    }
+
+    uint64_t hangs = 0, halts = 0, kept = 0;
+    double start = now_seconds();
+
+    for (uint64_t n = 0; n < execs; n++)
+    {
+        const input_t *parent = &corpus[next_random() % corpus_count];
+        input_t child = {scratch, parent->len};
+        memcpy(child.data, parent->data, parent->len);
+        mutate(&child, max_len);
+
+        vm_stop_reason reason = vm_coverage_run(vm, boot, child.data, child.len, budget);
+        hangs += reason == VM_STOP_BUDGET;
+        halts += reason == VM_STOP_HALT;
+
+        if (vm_coverage_merge(seen, vm->coverage) && corpus_count < MAX_CORPUS)
+        {
+            input_t *slot = &corpus[corpus_count++];
+            slot->data = malloc(max_len);
+            if (!slot->data)
+            {
+                corpus_count--;
+                continue;
+            }
+            memcpy(slot->data, child.data, child.len);
+            slot->len = child.len;
+            kept++;
+            if (out_dir)
+                save_input(out_dir, kept, slot);
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+    size_t edges = 0;
+    for (size_t i = 0; i < VM_COV_SIZE; i++)
+        edges += seen[i] != 0;
+
+    fprintf(stderr, "vmfuzz: %llu execs in %.2fs (%.0f/s), %zu edges, corpus %zu (+%llu), %llu halts, %llu hangs\n",
+            (unsigned long long)execs, elapsed, elapsed > 0 ? (double)execs / elapsed : 0.0, edges, corpus_count,
+            (unsigned long long)kept, (unsigned long long)halts, (unsigned long long)hangs);
+
+    for (size_t i = 0; i < corpus_count; i++)
+        free(corpus[i].data);
+    free(corpus);
+    free(scratch);
+    free(seen);
+    vm_coverage_destroy(vm->coverage);
+    vm->coverage = NULL;
+    vm_snapshot_release(boot);
+    vm_destroy(vm);
+    return 0;
+}
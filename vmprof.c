@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "pvm/assembler.h"
+#include "pvm/callgraph.h"
+#include "pvm/debugmap.h"
+#include "pvm/heatmap.h"
+#include "pvm/io.h"
+#include "pvm/profile.h"
+#include "pvm/sampler.h"
+#include "pvm/vm.h"
+
+// vmprof: run a program on the terminal and report where it spent its
+// instructions, by source line and by label.
+//
+//   vmprof [-t traps.asm] [-e entry] [-s period] [-x] [-c folded.txt] [-m words] [-M heat.txt]
+//          [-r input.log | -R input.log] [-n top] prog.asm
+//
+// By default the guest PC is sampled about every `period` instructions;
+// -x uses the exact per-PC counters instead. -c also tracks call paths
+// through JSR/TRAP and RET, prints the heaviest ones and writes folded
+// stacks for flame graphs. -m counts data loads and stores in cells of
+// `words` words (a power of two) and reports a memory heat map; -M also
+// writes the per-cell counts, at one word per cell unless -m says
+// otherwise. -x, -c and -m need a PVM_PROFILE build. The report goes to
+// stderr when the guest halts or input runs out.
+//
+// -r records the keyboard input of the run to a log and -R replays one in
+// place of the terminal, so a profiled or benchmarked workload can be
+// repeated exactly. A replay checks that it retired as many instructions
+// and printed the same output as the recording, and exits 1 if not.
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: vmprof [-t traps.asm] [-e entry] [-s period] [-x] [-c folded.txt] [-m words] "
+                    "[-M heat.txt] [-r input.log | -R input.log] [-n top] prog.asm\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *traps = NULL;
+    uint16_t entry = 0x3000;
+    uint64_t period = 1000;
+    size_t top = 20;
+    bool exact = false;
+    const char *folded = NULL;
+    unsigned long heat_words = 0;
+    const char *heat_path = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:e:s:xc:m:M:r:R:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            traps = optarg;
+            break;
+        case 'e':
+            entry = (uint16_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            period = strtoull(optarg, NULL, 10);
+            break;
+        case 'x':
+            exact = true;
+            break;
+        case 'c':
+            folded = optarg;
+            break;
+        case 'm':
+            heat_words = strtoul(optarg, NULL, 0);
+            break;
+        case 'M':
+            heat_path = optarg;
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'R':
+            replay_path = optarg;
+            break;
+        case 'n':
+            top = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1 || (record_path && replay_path))
+    {
+        usage();
+        return 1;
+    }
+
+#if !PVM_PROFILE
+    if (exact || folded || heat_words || heat_path)
+    {
+        fprintf(stderr, "Error: -x, -c, -m and -M need a build with PVM_PROFILE enabled\n");
+        return 1;
+    }
+#endif
+
+    unsigned heat_shift = 0;
+    if (heat_path && !heat_words)
+        heat_words = 1;
+    while (heat_words > (1ul << heat_shift))
+        heat_shift++;
+    if (heat_words && heat_words != (1ul << heat_shift))
+    {
+        fprintf(stderr, "Error: -m takes a power of two\n");
+        return 1;
+    }
+
+    debug_map_t *map = debug_map_create();
+    if (!map)
+        return 1;
+
+    segment_t *os = traps ? assemble_file_debug(traps, map) : NULL;
+    segment_t *program = assemble_file_debug(argv[optind], map);
+    if ((traps && !os) || !program)
+        return 1;
+
+    VM *vm = vm_create_sparse();
+    vm_sampler_t *sampler = exact ? NULL : vm_sampler_create(period);
+    if (!vm || (!exact && !sampler))
+        return 1;
+    if (exact && !(vm->profile = vm_profile_create()))
+        return 1;
+
+    if (os)
+        vm_load_segments(vm, os);
+    vm_load(vm, program, entry);
+    free_segments(os);
+    free_segments(program);
+
+    if (folded && !(vm->callgraph = vm_callgraph_create(vm)))
+        return 1;
+    if (heat_words && !(vm->heatmap = vm_heatmap_create(heat_shift)))
+        return 1;
+
+    vm_term_t term;
+    vm_record_t rec;
+    vm_replay_t rep;
+    vm_term_open(&term, STDIN_FILENO, STDOUT_FILENO);
+    vm_set_io(vm, vm_io_terminal(&term));
+    if (record_path)
+    {
+        if (!vm_record_open(&rec, record_path, vm_io_terminal(&term), &vm->counters.instructions))
+            return 1;
+        vm_set_io(vm, vm_io_record(&rec));
+    }
+    if (replay_path)
+    {
+        if (!vm_replay_open(&rep, replay_path, vm_io_terminal(&term), &vm->counters.instructions))
+            return 1;
+        vm_set_io(vm, vm_io_replay(&rep));
+    }
+
+    // A replay never blocks: polls ahead of the next logged key just see
+    // no input, so keep going until the log is used up.
+    vm_stop_reason reason;
+    for (;;)
+    {
+        reason = exact ? vm_run_for(vm, UINT64_MAX) : vm_sampler_run(sampler, vm, UINT64_MAX);
+        if (reason != VM_STOP_IO_WAIT)
+            break;
+        if (replay_path ? vm_replay_finished(&rep) : !vm_term_wait(&term, -1))
+            break;
+    }
+    vm_term_close(&term);
+
+    int status = 0;
+    if (record_path)
+        vm_record_close(&rec);
+    if (replay_path)
+    {
+        if (!vm_replay_check(&rep, stderr))
+            status = 1;
+        else if (rep.has_end)
+            fprintf(stderr, "vmprof: replay matches the recording\n");
+        vm_replay_close(&rep);
+    }
+
+    fprintf(stderr, "\nvmprof: stopped (%s) after %llu instructions",
+            vm_stop_reason_name(reason), (unsigned long long)vm->counters.instructions);
+    if (exact)
+    {
+        fprintf(stderr, "\n");
+        debug_map_report(map, vm->profile->pc, top, stderr);
+        vm_profile_destroy(vm->profile);
+        vm->profile = NULL;
+    }
+    else
+    {
+        fprintf(stderr, ", %llu samples\n", (unsigned long long)sampler->total);
+        debug_map_report(map, sampler->samples, top, stderr);
+    }
+
+    if (vm->callgraph)
+    {
+        vm_callgraph_report(vm->callgraph, map, top, stderr);
+
+        FILE *f = fopen(folded, "w");
+        if (f)
+        {
+            vm_callgraph_write_folded(vm->callgraph, map, f);
+            fclose(f);
+        }
+        else
+        {
+            perror(folded);
+        }
+        vm_callgraph_destroy(vm->callgraph);
+        vm->callgraph = NULL;
+    }
+
+    if (vm->heatmap)
+    {
+        vm_heatmap_report(vm->heatmap, map, top, stderr);
+
+        FILE *f = heat_path ? fopen(heat_path, "w") : NULL;
+        if (f)
+        {
+            vm_heatmap_dump(vm->heatmap, map, f);
+            fclose(f);
+        }
+        else if (heat_path)
+        {
+            perror(heat_path);
+        }
+        vm_heatmap_destroy(vm->heatmap);
+        vm->heatmap = NULL;
+    }
+
+    vm_sampler_destroy(sampler);
+    vm_destroy(vm);
+    debug_map_free(map);
+    return status;
+}